@@ -6,21 +6,32 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 #include <iterator>
 #include <utility>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <future>
 
 #include "TTree.h"
 
 class TDirectory;
+class TFile;
 
 // define some different implementation methods to compare for speed:
 //#define FEWER_CHECKS 1             // skip sanity/debug checks on every entry
 //#define OVERRIDE_BRANCH_ADDRESS 1  // override any other user SetBranchAddress settings
 //#define PREFER_PTRPTR 1            // for filling ROOT objects, tree->Branch() uses **obj, rather than *obj
 //#define NO_FILL_UNSET_DEFAULT 1    // don't set default values if unset
-//#define NO_BranchValue_STATS 1     // Don't keep stats for optimised BranchValue lookup. Otherwise, prints in ~TTreeIterator::Entry_iterator if verbose.
+//#define NO_BranchValue_STATS 1     // Don't keep stats for optimised BranchValue lookup. Otherwise, prints in ~TTreeIterator::Entry if verbose.
+//#define NO_BULK_READ 1             // don't use TBranch::GetBulkRead() for Batches (automatically set for ROOT < 6.16)
+//#define NO_BUFFER_MERGER 1         // don't provide ParallelFill (automatically set for ROOT < 6.12, which doesn't have TBufferMerger)
+//#define NO_BACKFILL 1              // catch up new branches with TBranch::Fill(), not BackFill() (automatically set for ROOT < 6.12)
 //#define USE_std_any 1              // use C++17's std::any, instead of Cpp11::any from detail/Cpp11_any.h
 //#define Cpp11_any_NOOPT 1          // don't use Cpp11::any's optimisations (eg. removing error checking)
+//#define NO_FUNDAMENTAL_ANY 1       // hold fundamental types in any, rather than the tagged union in detail/fundamental_any.h
+//#define BranchValue_any_SIZE 32    // bytes of storage in each BranchValue for values held without a heap allocation (Cpp11::basic_any only, default 32)
 //#define NO_DICT 1                  // don't create TTreeIterator dictionary
 
 #if defined(USE_std_any) && (__cplusplus < 201703L)   // <version> not available until GCC9, so no way to check __cpp_lib_any without including <any>.
@@ -37,6 +48,10 @@ class TDirectory;
 # include <any>
 #endif
 
+#ifndef NO_FUNDAMENTAL_ANY
+# include "TTreeIterator/detail/fundamental_any.h"     // tagged union for fundamental types, any for the rest
+#endif
+
 #if defined(USE_std_any) || defined(Cpp11_std_any)
 namespace any_namespace = ::std;
 #else
@@ -50,7 +65,10 @@ class TTreeIterator : public TNamed {
 public:
 
 #ifndef USE_std_any
-  using any_type = any_namespace::any;
+# ifndef BranchValue_any_SIZE
+#  define BranchValue_any_SIZE 32
+# endif
+  using any_type = any_namespace::basic_any<BranchValue_any_SIZE>;   // larger than any, so small structs are held inline
   using type_code_t = any_namespace::any_type_code;
   template<typename T> static constexpr type_code_t type_code() { return any_namespace::type_code<T>(); }
 #else
@@ -58,10 +76,32 @@ public:
   using type_code_t = std::size_t;
   template<typename T> static constexpr type_code_t type_code() { return typeid(T).hash_code(); }
 #endif
+#ifndef NO_FUNDAMENTAL_ANY
+  using value_holder = Cpp11::fundamental_any<any_type>;
+#else
+  using value_holder = any_type;
+#endif
 
   class Entry;
   class Entry_iterator;
   class Fill_iterator;
+  template <typename T> class BranchColumn;
+  template <typename... Fields> class Typed;   // defined in detail/TTreeIterator_typed.h
+  template <typename T> class Span;            // defined in detail/TTreeIterator_batch.h
+  class Batch;
+  class Batch_iterator;
+  class FillColumn;
+  template <typename F> class Where_iterator;  // defined in detail/TTreeIterator_where.h
+  class Selection;                             // defined in detail/TTreeIterator_select.h
+  class Select_iterator;
+  struct ChainFile;                            // defined in detail/TTreeIterator_parallel.h
+  struct ParallelStats;
+  class ParallelQueue;
+
+  // Base for the field definitions of a Typed tree. Derived class must define name(), eg.
+  //   struct pt : TTreeIterator::Field<double> { static constexpr const char* name() { return "pt"; } };
+  // or use TTreeIterator_Field(pt,double).
+  template <typename T> struct Field { using type = T; };
 
   // ===========================================================================
   class BranchValue {
@@ -82,18 +122,16 @@ public:
     Long64_t         index()   const { return fEntry.index();   }
     int              verbose() const { return fEntry.verbose(); }
     Entry&           entry()   const { return fEntry;           }
-    Entry_iterator&  iter()    const { return fEntry.iter();    }
     TTreeIterator&   tree()    const { return fEntry.tree();    }
     TTree*           GetTree() const { return fEntry.GetTree(); }
 
     // function pointer definition to allow access to templated code
-    typedef bool (*SetValueAddress_t) (BranchValue* ibranch, const char* call, bool redo);
     typedef void (*SetDefaultValue_t) (BranchValue* ibranch);
 
-    // not called by user, but needs to be public so can be called by std::vector::emplace_back()
+    // not called by user, but needs to be public so can be called by std::deque::emplace_back()
     template <typename T>
-    BranchValue (const char* name, type_code_t type,                     T&& value,   Entry& entry,   SetDefaultValue_t fd, SetValueAddress_t fa)
-      :                fName(name),      fType(type), fValue(std::forward<T>(value)), fEntry(entry), fSetDefaultValue(fd), fSetValueAddress(fa) {}
+    BranchValue (const char* name, type_code_t type,                     T&& value,   Entry& entry,   SetDefaultValue_t fd)
+      :                fName(name),      fType(type), fValue(std::forward<T>(value)), fEntry(entry), fSetDefaultValue(fd) {}
 
     // delete unneeded initialisers so we don't accidentally call them
     BranchValue()                                = delete;
@@ -108,26 +146,41 @@ public:
     friend Entry;
     friend Entry_iterator;
     friend Fill_iterator;
-
-    template <typename T>       T& SetValue(T&& value) { return fValue.emplace<T>(std::forward<T>(value)); }
+    template <typename> friend class BranchColumn;
+    friend FillColumn;
+
+    // Assign in place, so the address given to the branch stays valid. A std::vector keeps its buffer, rather than taking val's.
+    template <typename V, typename T> static V& AssignValue (V& to, T&& val, std::false_type) { return to = std::forward<T>(val); }
+    template <typename V, typename T> static V& AssignValue (V& to, T&& val, std::true_type)  { if (&to != &val) to.assign (val.begin(), val.end()); return to; }
+    template <typename V, typename T> static V& AssignValue (V& to, T&& val) { return AssignValue (to, std::forward<T>(val), is_vector<V>()); }
+#ifndef NO_FUNDAMENTAL_ANY
+    template <typename T> const T& GetValue()    const { return *fValue.get<typename std::remove_reference<T>::type>(); }
+    template <typename T>       T& GetValue()          { return *fValue.get<typename std::remove_reference<T>::type>(); }
+    template <typename T> const T* GetValuePtr() const { return  fValue.get<T>(); }
+    template <typename T>       T* GetValuePtr()       { return  fValue.get<T>(); }
+#else
     template <typename T> const T& GetValue()    const { return any_namespace::any_cast<T&>(fValue); }
     template <typename T>       T& GetValue()          { return any_namespace::any_cast<T&>(fValue); }
     template <typename T> const T* GetValuePtr() const { return any_namespace::any_cast<T>(&fValue); }
     template <typename T>       T* GetValuePtr()       { return any_namespace::any_cast<T>(&fValue); }
+#endif
 
     template <typename T> const T* GetBranchValue() const;
     template <typename T> bool     SetBranchAddress (const char* call="Get");
 
     template <typename T> static void SetDefaultValue (BranchValue* ibranch);
-    template <typename T> static bool SetValueAddress (BranchValue* ibranch, const char* call, bool redo=false);
+    template <typename T> static bool SetValueAddress (BranchValue* ibranch, const char* call);
 
     bool GetBranch() const;
     void ResetAddress();
+    void MarkSet();
 
     std::string       fName;
     type_code_t       fType;
-    any_type          fValue;
+    std::size_t       fHash   = 0;                 // Entry::BranchHash(fName,fType), for fBranchIndex lookup
+    value_holder      fValue;
     mutable void*     fPvalue = nullptr;
+    void*             fAddr   = nullptr;           // address bound to the read branch (ours or the user's), checked by Entry::CheckAddresses()
 #ifndef OVERRIDE_BRANCH_ADDRESS
     mutable void**    fPuser  = nullptr;
 #endif
@@ -135,9 +188,8 @@ public:
     Entry&            fEntry;
     mutable Long64_t  fLastGet = -1;
     SetDefaultValue_t fSetDefaultValue = nullptr;  // function to set value to the default
-    SetValueAddress_t fSetValueAddress = nullptr;  // function to set the address again
     bool              fSet    = false;
-    bool              fUnset  = false;
+    bool              fDirty  = false;                 // set in this entry, so in Entry::fSetBranches
     bool              fIsobj  = false;
   };
 
@@ -164,7 +216,6 @@ public:
     std::size_t      index()   const { return fIndex;           }
     int              verbose() const { return fEntry.verbose(); }
     const Entry&     entry()   const { return fEntry;           }
-    Entry_iterator&  iter()    const { return fEntry.iter();    }
     TTreeIterator&   tree()    const { return fEntry.tree();    }
     TTree*           GetTree() const { return fEntry.GetTree(); }
 
@@ -211,7 +262,9 @@ public:
     using size_type   = std::size_t;
     using difference_type = std::ptrdiff_t;
 
-    Entry (Entry_iterator& iter, Long64_t index=0) : fIndex(index), fIter(iter) {}
+    Entry (TTreeIterator& treeI, Long64_t index=0, Long64_t last=-1)
+      : fIndex(index), fEnd(last), fTreeI(treeI), fGeneration(NextGeneration()),
+        fLearn(treeI.LearnEntries() > 0 ? treeI.LearnEntries()+1 : 0) {}
     ~Entry();
 
     Getter Get        (const char* name) const { return Getter(*this,name); }
@@ -243,6 +296,13 @@ public:
     template <typename T>
     const T& Set(const char* name, T&& val, const char* leaflist, Int_t bufsize, Int_t splitlevel);
 
+    // Reference to the value to be filled for a branch (created if necessary), which can be filled in place, eg.
+    //   auto& vx = entry.Ref<std::vector<double>>("vx");
+    //   vx.clear();  // still holds the previous entry's values
+    //   for (...) vx.push_back(x);
+    // This avoids copying the value, or reallocating a vector's buffer, for each entry.
+    template <typename T> T& Ref (const char* name);
+
     Int_t GetEntry (Int_t getall=0);
     Int_t Fill();
 
@@ -251,24 +311,29 @@ public:
 
     // common accessors
     Long64_t          index()   const { return fIndex;          }
-    int               verbose() const { return fIter.verbose(); }
-    Entry_iterator&   iter()    const { return fIter;           }
-    TTreeIterator&    tree()    const { return fIter.tree();    }
-    TTree*            GetTree() const { return fIter.GetTree(); }
+    int               verbose() const { return fTreeI.verbose(); }
+    TTreeIterator&    tree()    const { return fTreeI;           }
+    TTree*            GetTree() const { return fTreeI.GetTree(); }
 
   protected:
+    friend TTreeIterator;
     friend Entry_iterator;
     friend Fill_iterator;
     friend BranchValue_iterator;
     friend BranchValue;
+    template <typename> friend class BranchColumn;
+    friend Batch;
+    friend FillColumn;
+    template <typename> friend class Where_iterator;
 
     template <typename T> BranchValue* GetBranch      (const char* name) const;
     template <typename T> BranchValue* GetBranchValue (const char* name) const;
                           BranchValue* GetBranchValue (const char* name, type_code_t type) const;
     template <typename T> BranchValue* NewBranch      (const char* name, T&& val, const char* leaflist, Int_t bufsize, Int_t splitlevel);
     template <typename T> BranchValue* SetBranchValue (const char* name, T&& val) const;
-    template <typename T> Int_t        FillBranch     (TBranch* branch, const char* name);
-    void SetBranchAddressAll (const char* call="SetBranchValue") const;
+    template <typename T> Long64_t     BackFill       (BranchValue* ibranch, Long64_t nfill);
+    void IndexBranch (std::size_t ib) const;
+    static std::size_t BranchHash (const char* name, type_code_t type);
 
     // Create empty branch
     template <typename T>
@@ -277,21 +342,72 @@ public:
     }
     template <typename T> TBranch* Branch (const char* name, const char* leaflist, Int_t bufsize, Int_t splitlevel);
 
-    Entry& LoadTree(Long64_t index) { fIndex = index; fLocalIndex = GetTree()->LoadTree (index); return *this; }
+    Entry& LoadTree(Long64_t index) {
+      fIndex = index;
+      fLocalIndex = GetTree()->LoadTree (index);
+      if (GetTree()->GetTreeNumber() != fTreeNumber) ChangeTree();
+      if (fLocalIndex >= fPreOpenAt) PreOpen();
+      if (fLearn > 0 && --fLearn == 0) EndLearning();
+      return *this;
+    }
+    void ChangeTree();
+    void PreOpen();
+    void EndLearning();
+    bool CheckAddresses();
+    void DisableUntouched();
+    void SaveBranchStatus (TObjArray* list);
+    void EnableAll();
+    void EndLoop();
+    void UnfreezeCache();
+    void TreeDeleted();
+    void EnableParallelUnzip();
+    void RestoreParallelUnzip();
+    void TrainCache();
+
+    // Unique number for each Entry, so a BranchColumn can tell if its cached BranchValue* belongs to this Entry.
+    static ULong64_t NextGeneration() {
+      static std::atomic<ULong64_t> generation {0};
+      return ++generation;
+    }
 
     Long64_t fIndex;
+    const Long64_t fEnd;          // end of the loop (-1 if open-ended), for AutoTune
     Long64_t fLocalIndex=-1;
-    Entry_iterator& fIter;
-
-    mutable std::vector<BranchValue> fBranches;
-    mutable std::vector<BranchValue>::iterator fLastBranch;
+    Int_t    fTreeNumber=-1;
+    Long64_t fFillOffset=0;       // entries already written and reset from the tree (by ParallelFill) before this one
+    TTreeIterator& fTreeI;
+    mutable ULong64_t fGeneration;
+    Long64_t fLearn;              // LoadTree calls left before EndLearning (0 = don't, -1 = done, -2 = TTreeCache set by caller: leave it)
+    Long64_t fFrozenCache=0;      // size of the TTreeCache frozen by Where(), which is replaced at the end of the loop
+    bool     fTouchedOnly=false;  // we disabled the branches we don't use
+    struct BranchStatus { std::string fName; TBranch* fBranch; bool fActive; };
+    std::vector<BranchStatus> fBranchStatus;   // status of each branch before DisableUntouched(), restored by EnableAll()
+    Int_t    fParallelUnzip=-1;   // TTree::SetParallelUnzip setting before we enabled it (-1 = we didn't)
+    Long64_t fPreOpenAt=TTree::kMaxEntries;           // local entry at which to start opening the next file in the chain
+    std::future<std::unique_ptr<TFile>> fPreOpened;   // next file, opened in the background
+
+    mutable std::deque<BranchValue> fBranches;  // deque, so BranchValue addresses (registered with SetBranchAddress) stay fixed as we add more
+    mutable std::vector<std::size_t> fBranchIndex;  // open-addressing hash table of fBranches index+1 (0=empty slot), keyed on (name,type)
+    mutable std::size_t fLastBranch = 0;
     mutable bool fTryLast = false;
+    std::vector<BranchValue*> fSetBranches;      // branches set in this entry
+    std::vector<BranchValue*> fLastSetBranches;  // branches set in the previous entry: Fill() resets them to the default if they aren't set again
+
+    mutable ULong64_t fTotFill=0, fTotWrite=0, fTotRead=0;
+#ifndef NO_BranchValue_STATS
+    mutable size_t fNhits=0, fNmiss=0;
+#endif
+    bool fWriting=false;
   };
 
   // ===========================================================================
-  // Interface to std::iterator to allow range-based for loop
+  // Interface to std::iterator to allow range-based for loop.
+  // The Entry (with its bound branch values) is shared between copies of the iterator, so a copy
+  // (eg. in postfix ++ or an STL algorithm) is just an index and a pointer.
+  // This makes it an input iterator: an Entry reference is only valid until any copy of the iterator is advanced,
+  // so multi-pass algorithms (eg. std::max_element, std::adjacent_find) can't be used.
   class Entry_iterator
-    : public std::iterator< std::forward_iterator_tag, // iterator_category   [could easily be random_access_iterator if we implemented the operators]
+    : public std::iterator< std::input_iterator_tag,   // iterator_category   [copies share the Entry]
                             Entry,                     // value_type
                             Long64_t,                  // difference_type
                             const Entry*,              // pointer
@@ -299,14 +415,14 @@ public:
   {
   public:
 
-    Entry_iterator (TTreeIterator& treeI, Long64_t first, Long64_t last) : fIndex(first), fEnd(last), fTreeI(treeI), fEntry(*this,0) {}
-//  Entry_iterator (const Entry_iterator& in) : fIndex(in.fIndex), fEnd(in.fEnd), fTreeI(in.fTreeI) {}  // default probably OK
-    ~Entry_iterator();
-    Entry_iterator& operator++() { ++fIndex; return *this; }
-    Entry_iterator  operator++(int) { Entry_iterator it = *this; ++fIndex; return it; }
+    Entry_iterator (TTreeIterator& treeI, Long64_t first, Long64_t last)
+      : Entry_iterator (treeI, first, last, treeI.NewEntry(last)) {}
+    ~Entry_iterator() { if (fEntry && fEntry == fTreeI.fEntry && fEntry.use_count() == 2) fEntry->EndLoop(); }   // end of loop, but TTreeIterator keeps the Entry
+    Entry_iterator& operator++() { if (++fIndex == fNextFile) NextFile(); return *this; }
+    Entry_iterator  operator++(int) { Entry_iterator it = *this; ++*this; return it; }
     bool operator!= (const Entry_iterator& other) const { return fIndex != other.fIndex; }
     bool operator== (const Entry_iterator& other) const { return fIndex == other.fIndex; }
-    const Entry& operator*() const { return fEntry.LoadTree (fIndex < fEnd ? fIndex : -1); }
+    const Entry& operator*() const { return fEntry->LoadTree (fIndex < fEnd ? fIndex : -1); }
     Long64_t last() { return fEnd; }
 
     // common accessors
@@ -316,34 +432,58 @@ public:
     TTree*          GetTree() const { return fTreeI.GetTree(); }
 
   protected:
+    friend TTreeIterator;
     friend BranchValue;
     friend Entry;
 
+    Entry_iterator (TTreeIterator& treeI, Long64_t first, Long64_t last, std::shared_ptr<Entry> entry)
+      : fIndex(first), fEnd(last), fTreeI(treeI), fEntry(std::move(entry)) {}
+    void NextFile();
+
     Long64_t fIndex;
     const Long64_t fEnd;
+    Long64_t fNextFile = -1;         // lazy chain: first entry of the next file, where we check if there are more entries
     TTreeIterator& fTreeI;
-    mutable Entry fEntry;   // local copy so we can return it by reference
-
-    mutable ULong64_t fTotFill=0, fTotWrite=0, fTotRead=0;
-#ifndef NO_BranchValue_STATS
-    mutable size_t fNhits=0, fNmiss=0;
-#endif
-    bool fWriting=false;
+    std::shared_ptr<Entry> fEntry;   // shared by all copies, so we can return it by reference
   };
 
   // ===========================================================================
   class Fill_iterator : public Entry_iterator {
   public:
     Fill_iterator (TTreeIterator& treeI, Long64_t first, Long64_t last) : Entry_iterator(treeI,first,last) {}
-    ~Fill_iterator() { Write(); }
+    ~Fill_iterator() { if (fEntry.use_count() == 1) Write(); }   // the last copy writes the tree
     Fill_iterator& operator++() { ++fIndex; return *this; }
     Fill_iterator  operator++(int) { Fill_iterator it = *this; ++fIndex; return it; }
-    Entry& operator*() const { fEntry.fIndex = fIndex; return fEntry; }
+    Entry& operator*() const { fEntry->fIndex = fIndex; return *fEntry; }
 
-    Fill_iterator begin() { return Fill_iterator (fTreeI, fIndex, fEnd); }
-    Fill_iterator end()   { return Fill_iterator (fTreeI, fEnd,   fEnd); }
+    Fill_iterator begin() { return *this; }
+    Fill_iterator end()   { Fill_iterator it = *this; it.fIndex = fEnd; return it; }
 
     Int_t Write (const char* name=0, Int_t option=0, Int_t bufsize=0);
+    Long64_t FillColumns (const std::vector<FillColumn>& columns);  // see detail/TTreeIterator_batch.h
+  };
+
+  // ===========================================================================
+  // A handle for a single branch of type T. It is bound to the Entry's BranchValue the first time
+  // it is used, so later entries don't need to look up the branch. Use as column(entry), or as
+  // *column (or column->) to get the value from the last-used Entry. eg.
+  //   auto x = iter.Column<double>("x");
+  //   for (auto& entry : iter) sum += x(entry);
+  template <typename T>
+  class BranchColumn {
+  public:
+    BranchColumn (const char* name) : fName(name) {}
+    const T& operator() (const Entry& entry) const;
+    const T& Set (Entry& entry, const T& val) const;   // entry.Set(name,val), creating the branch the first time
+    const T& operator*() const;
+    const T* operator->() const { return &**this; }
+    const std::string& GetName() const { return fName; }
+
+  protected:
+    std::string          fName;
+    mutable const Entry* fEntry      = nullptr;
+    mutable ULong64_t    fGeneration = 0;
+    mutable BranchValue* fBranch     = nullptr;
   };
 
   // ===========================================================================
@@ -399,6 +539,34 @@ public:
   Int_t           GetBufsize()               const  { return       fBufsize;                    }
   TTreeIterator&  SetSplitlevel (Int_t splitlevel)  { fSplitlevel = splitlevel;   return *this; }
   Int_t           GetSplitlevel()            const  { return       fSplitlevel;                 }
+  // Number of entries used to learn which branches to add to the TTreeCache (default 0 = leave the TTreeCache to ROOT).
+  // SetTouchedOnly and SetPrefetch need a learning phase, so they learn from the first entry if this is 0.
+  TTreeIterator&  SetLearnEntries (Long64_t n)      { fLearnEntries = n;          return *this; }
+  Long64_t        GetLearnEntries()          const  { return       fLearnEntries;               }
+  // After the learning entries, disable all the branches we haven't used (so GetEntry won't read them), enabling others as they are used.
+  // All branches are enabled again at the end of the loop.
+  TTreeIterator&  SetTouchedOnly (bool t)           { fTouchedOnly = t;           return *this; }
+  bool            GetTouchedOnly()           const  { return       fTouchedOnly;                }
+  // When the TTreeCache is set up after the learning entries, read ahead and unzip baskets in the background.
+  // This uses TTreeCacheUnzip, which runs on ROOT's implicit MT thread pool if ROOT::EnableImplicitMT() was called.
+  // TTree::SetParallelUnzip() is global, so it is only enabled during the loop, and the previous setting restored at the end.
+  TTreeIterator&  SetPrefetch (bool p)              { fPrefetch = p;              return *this; }
+  bool            GetPrefetch()              const  { return       fPrefetch;                   }
+  // For a TChain, start opening the next file in a background thread when we have read this fraction of the current file's entries
+  // (negative = don't). This reads the file header, StreamerInfo, and TTree, so the TChain doesn't wait as long to open it.
+  // NB. calls ROOT::EnableThreadSafety().
+  TTreeIterator&  SetPreOpen (double fraction)      { fPreOpen = fraction;        return *this; }
+  double          GetPreOpen()               const  { return       fPreOpen;                    }
+  // For a TChain, loop over the entries file by file, without calling GetEntries() first (which opens every file in the chain).
+  // end() is then TTree::kMaxEntries, and the loop stops when there are no more files.
+  TTreeIterator&  SetLazyChain (bool l)             { fLazyChain = l;             return *this; }
+  bool            GetLazyChain()             const  { return       fLazyChain;                  }
+  // When filling, measure each branch's size in the first learnEntries entries, then set the cluster size (TTree::SetAutoFlush)
+  // to give about clusterBytes compressed bytes per cluster, and each branch's basket size to hold one cluster.
+  // If FillEntries() was given the number of entries, clusters are kept small enough to give at least minClusters, for parallel reading.
+  TTreeIterator&  SetAutoTune (Long64_t clusterBytes, Int_t minClusters=0, Long64_t learnEntries=1000)
+    { fAutoTuneBytes = clusterBytes; fAutoTuneClusters = minClusters; fAutoTuneEntries = learnEntries; return *this; }
+  Long64_t        GetAutoTune()              const  { return       fAutoTuneBytes;              }
 #ifndef OVERRIDE_BRANCH_ADDRESS  // only need flag if compiled in
   TTreeIterator&  SetOverrideBranchAddress (bool o) { fOverrideBranchAddress = o; return *this; }
   bool            GetOverrideBranchAddress() const  { return fOverrideBranchAddress;            }
@@ -407,6 +575,14 @@ public:
   bool            GetOverrideBranchAddress() const  { return false;                             }
 #endif
 
+  // A read loop (begin()/end()) keeps its Entry for the next loop, so looping over the same tree again doesn't need to look
+  // up the branches and set their addresses again. The Entry is dropped (and its branch addresses reset) by SetTree(), Add(),
+  // FillEntries(), Batches(), a Typed loop, a nested loop, or this method. If you set a branch's address yourself between
+  // loops, the next loop reads through your address (as a new Entry would), or binds a new Entry if an address was reset.
+  // While an Entry is kept, we are in gROOT's list of cleanups, so it is also dropped if the tree is deleted (eg. its file closed).
+  void ResetBranchAddresses();
+  void RecursiveRemove (TObject* obj) override;
+
   std::string BranchNamesString (bool include_children=true, bool include_inactive=false);
   std::vector<std::string> BranchNames (bool include_children=false, bool include_inactive=false);
 
@@ -422,6 +598,30 @@ public:
   Entry_iterator begin();
   Entry_iterator end();
   Fill_iterator FillEntries (Long64_t nfill=-1);
+  Batch_iterator Batches (Long64_t nbatch);  // for (auto& batch : iter.Batches(n)), see detail/TTreeIterator_batch.h
+  Long64_t FillColumns (const std::vector<FillColumn>& columns);  // iter.FillColumns({{"x",xs},{"y",ys}}), see detail/TTreeIterator_batch.h
+  // for (auto& entry : iter.Where(pred, {"pt","eta"})) loops over entries passing pred(entry), which uses branches pt and eta.
+  // See detail/TTreeIterator_where.h
+  template <typename F> Where_iterator<typename std::decay<F>::type> Where (F&& pred, const std::vector<std::string>& branches={});
+  // Selection of entries passing pred(entry), which can be combined with &, |, and -, then looped over with
+  // for (auto& entry : iter.Select(sel)). See detail/TTreeIterator_select.h
+  template <typename F> Selection Filter (F&& pred);
+  template <typename F> Selection Filter (const Selection& within, F&& pred);
+  Select_iterator Select (const Selection& sel);   // sel must stay valid until the end of the loop
+  Select_iterator Select (Selection&& sel);        // a temporary, eg. iter.Select(a & b), is kept by the iterator
+
+  // Multi-threaded loop over all entries, calling fn(entry) or fn(entry,slot). See detail/TTreeIterator_parallel.h
+  template <typename F> Long64_t ParallelForEach (unsigned int nthreads, F&& fn);
+
+  // Open the files of a TChain in nthreads threads, to get their numbers of entries, rather than one at a time in GetEntries().
+  // See detail/TTreeIterator_parallel.h
+  Long64_t PrescanChain (unsigned int nthreads=0);
+
+  // Multi-threaded fill of nfill entries into a new file, calling fn(entry) or fn(entry,slot). See detail/TTreeIterator_parallel.h
+  template <typename F> static Long64_t ParallelFill (const char* filename, const char* treename, Long64_t nfill, unsigned int nthreads, F&& fn, int verbose=0);
+
+  // Pre-bound branch handle
+  template <typename T> static BranchColumn<T> Column (const char* name) { return BranchColumn<T>(name); }
 
   // Convenience function to return the type name
   template <typename T> static const char* tname(const char* name=0);
@@ -437,14 +637,32 @@ private:
   template <typename T> static decltype(T::leaflist) GetLeaflistImpl(int)  { return T::leaflist; }
   template <typename T> static const char*           GetLeaflistImpl(long) { return nullptr;     }
 
+  // call fn(entry,slot) if it takes two arguments, otherwise fn(entry)
+  template <typename F, typename E> static auto CallEntry (F& fn, E& entry, unsigned int slot, int)  -> decltype(fn(entry,slot), void()) { fn(entry,slot); }
+  template <typename F, typename E> static auto CallEntry (F& fn, E& entry, unsigned int,      long) -> decltype(fn(entry),      void()) { fn(entry);      }
+
 protected:
 
   // remove_cvref_t (std::remove_cvref_t for C++11).
   template<typename T> using remove_cvref_t = typename std::remove_cv<typename std::remove_reference<T>::type>::type;
+  template<typename T> struct is_vector : std::false_type {};
 
   // internal methods
   void Init (TDirectory* dir=nullptr, bool owned=true);
+  std::shared_ptr<Entry> NewEntry (Long64_t last, bool keep=false);
+  void KeepEntry (std::shared_ptr<Entry> entry);
+  Select_iterator SelectImpl (std::shared_ptr<const Selection> sel);
   static void BranchNames (std::vector<std::string>& allbranches, TObjArray* list, bool include_children, bool include_inactive, const std::string& pre="");
+  bool GetChainFiles (std::vector<ChainFile>& files) const;
+  Long64_t ClusterStart (Long64_t entry) const;
+  Long64_t ClusterEnd   (Long64_t entry) const;
+  Long64_t LearnEntries() const { return fLearnEntries > 0 ? fLearnEntries : (fTouchedOnly || fPrefetch) ? 1 : 0; }
+  void ActivateBranch (TBranch* branch) const;
+  void AutoTune (Long64_t nentries, Long64_t nfill);
+  Int_t TuneBaskets (TObjArray* branches, double scale) const;
+  static TFile* MergerFile (TTree* tree);
+  template <typename F> void ParallelWorker (F& fn, const std::vector<ChainFile>& files, ParallelQueue& queue, Long64_t nentries,
+                                             unsigned int slot, ParallelStats& stats) const;
 
   // Hack to allow access to protected method TTree::CheckBranchAddressType()
   struct TTreeProtected : public TTree {
@@ -457,7 +675,17 @@ protected:
   bool   fTreeOwned  = false;
   Int_t  fBufsize    = 32000;
   Int_t  fSplitlevel = 99;
+  Long64_t fLearnEntries = 0;
+  bool   fTouchedOnly = false;
+  bool   fPrefetch    = false;
+  bool   fLazyChain   = false;
+  double fPreOpen     = -1.0;
+  Long64_t fAutoTuneBytes    = 0;
+  Int_t    fAutoTuneClusters = 0;
+  Long64_t fAutoTuneEntries  = 1000;
   int    fVerbose    = 0;
+  std::shared_ptr<Entry> fEntry;   // kept from the last read loop
+  bool   fCleanup    = false;      // in gROOT's list of cleanups while we keep fEntry
 #ifndef OVERRIDE_BRANCH_ADDRESS  // only need flag if compiled in
   bool   fOverrideBranchAddress = false;
 #endif
@@ -467,6 +695,20 @@ protected:
 #endif
 };
 
+template <typename E, typename A> struct TTreeIterator::is_vector<std::vector<E,A>> : std::true_type {};
+
+// Get or set a branch value, caching the branch lookup at this call site (separately for each thread).
+// This is like entry["x"] (or entry.Get<double>("x")), but after the first entry costs about the same as a BranchColumn. eg.
+//   double x = TTreeIterator_Get(entry, "x", double);
+//   TTreeIterator_Set(entry, "y", 2*x, double);
+// NAME must be a string literal (or other constant), since it is only used to look up the branch the first time.
+#define TTreeIterator_Get(ENTRY,NAME,...) \
+  ([](const ::TTreeIterator::Entry& e_) -> const __VA_ARGS__& { \
+    static thread_local ::TTreeIterator::BranchColumn<__VA_ARGS__> column_(NAME); return column_(e_); } (ENTRY))
+#define TTreeIterator_Set(ENTRY,NAME,VALUE,...) \
+  ([](::TTreeIterator::Entry& e_, const __VA_ARGS__& v_) -> const __VA_ARGS__& { \
+    static thread_local ::TTreeIterator::BranchColumn<__VA_ARGS__> column_(NAME); return column_.Set(e_,v_); } (ENTRY,VALUE))
+
 template<> inline float         TTreeIterator::type_default() { return std::numeric_limits<float      >::quiet_NaN(); }
 template<> inline double        TTreeIterator::type_default() { return std::numeric_limits<double     >::quiet_NaN(); }
 template<> inline long double   TTreeIterator::type_default() { return std::numeric_limits<long double>::quiet_NaN(); }
@@ -476,5 +718,10 @@ template<> inline long int      TTreeIterator::type_default() { return -1;  }
 template<> inline long long int TTreeIterator::type_default() { return -1;  }
 
 #include "TTreeIterator/detail/TTreeIterator_detail.h"
+#include "TTreeIterator/detail/TTreeIterator_typed.h"
+#include "TTreeIterator/detail/TTreeIterator_batch.h"
+#include "TTreeIterator/detail/TTreeIterator_parallel.h"
+#include "TTreeIterator/detail/TTreeIterator_where.h"
+#include "TTreeIterator/detail/TTreeIterator_select.h"
 
 #endif /* ROOT_TTreeIterator */
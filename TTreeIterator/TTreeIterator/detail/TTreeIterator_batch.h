@@ -0,0 +1,369 @@
+// Batched (columnar) access to a TTree, using TTreeIterator::Batches() and TTreeIterator::FillColumns().
+
+#ifndef ROOT_TTreeIterator_batch
+#define ROOT_TTreeIterator_batch
+
+#include <cstring>
+#include <type_traits>
+
+#include "RVersion.h"
+#include "TBufferFile.h"
+#include "TDataType.h"
+#include "TMath.h"
+
+#if !defined(NO_BULK_READ) && (ROOT_VERSION_CODE < ROOT_VERSION(6,16,0))
+# define NO_BULK_READ 1    // TBranch::GetBulkRead() not available
+#endif
+#ifndef NO_BULK_READ
+# include "ROOT/TBulkBranchRead.hxx"
+#endif
+
+// ===========================================================================
+// Read-only view of a contiguous array of values, like C++20's std::span<const T>.
+template <typename T>
+class TTreeIterator::Span {
+public:
+  Span (const T* data=nullptr, std::size_t size=0) : fData(data), fSize(size) {}
+  const T*    begin() const { return fData;         }
+  const T*    end()   const { return fData + fSize; }
+  const T*    data()  const { return fData;         }
+  std::size_t size()  const { return fSize;         }
+  bool        empty() const { return fSize == 0;    }
+  const T& operator[] (std::size_t i) const { return fData[i]; }
+protected:
+  const T*    fData;
+  std::size_t fSize;
+};
+
+// ===========================================================================
+// The values of the requested branches for a range of consecutive entries, eg.
+//   for (auto& batch : iter.Batches(1000)) {
+//     for (double x : batch.Get<double>("x")) sum += x;
+//   }
+// Where possible, the values are read a basket at a time with TBranch::GetBulkRead(), and the
+// Span points straight into the basket buffer. Otherwise (eg. for a leaflist branch) they are
+// read entry by entry. A Span is only valid until the next batch.
+// Batches do not cross file boundaries in a TChain, so can be shorter than requested.
+class TTreeIterator::Batch {
+public:
+  Batch (Batch_iterator& iter) : fIter(iter) {}
+  Batch (const Batch&)            = delete;
+  Batch& operator= (const Batch&) = delete;
+
+  // T must be trivially copyable: a fundamental type or leaflist struct
+  template <typename T> Span<T> Get (const char* name) const;
+
+  // common accessors
+  Long64_t          index()   const { return fIndex; }   // first entry in the batch
+  Long64_t          size()    const { return fSize;  }   // number of entries in the batch
+  int               verbose() const;
+  TTreeIterator&    tree()    const;
+  TTree*            GetTree() const;
+
+protected:
+  friend Batch_iterator;
+
+  struct Column {
+    Column (const char* name, type_code_t type, EDataType datatype, std::size_t elemsize)
+      : fName(name), fType(type), fDataType(datatype), fElemSize(elemsize) {}
+    std::string       fName;
+    type_code_t       fType;
+    EDataType         fDataType;
+    std::size_t       fElemSize;
+    TBranch*          fBranch      = nullptr;
+    bool              fBulk        = false;    // use TBranch::GetBulkRead()
+    Long64_t          fIndex       = -1;       // batch for which fData is valid
+    const char*       fData        = nullptr;
+    Long64_t          fBasketFirst = -1;       // range of (local) entries in fBuffer
+    Long64_t          fBasketLast  = -1;
+    const char*       fBasketData  = nullptr;
+    TBufferFile       fBuffer {TBuffer::kWrite, 32*1024};
+    std::vector<char> fCopy;                   // values copied here if the batch crosses baskets, or can't use bulk read
+  };
+
+  Batch& LoadTree (Long64_t first, Long64_t last);
+  template <typename T> Column& GetColumn (const char* name) const;
+  void Bind (Column& col) const;
+  bool ReadBulk (Column& col) const;
+  bool ReadBasket (Column& col, Long64_t entry) const;
+  template <typename T> void ReadEntries (Column& col) const;
+
+  Long64_t fIndex      = -1;
+  Long64_t fLocalIndex = -1;
+  Long64_t fSize       = 0;
+  Int_t    fTreeNumber = -1;
+  Batch_iterator& fIter;
+  mutable std::deque<Column> fColumns;  // deque, since Column can't be moved
+};
+
+// ===========================================================================
+// An array of values to be filled into a branch, one per entry, by FillColumns(), eg.
+//   std::vector<double> xs = ...;
+//   iter.FillColumns ({{"x", xs}, {"n", ns.data(), ns.size()}});
+// The data is not copied, so must stay valid until FillColumns() returns.
+class TTreeIterator::FillColumn {
+public:
+  template <typename T> FillColumn (const char* name, const T* data, std::size_t size)
+    : fName(name), fData(data), fSize(size), fFirst(&First<T>), fCopy(&Copy<T>) {}
+  template <typename T> FillColumn (const char* name, const std::vector<T>& data) : FillColumn (name, data.data(), data.size()) {}
+  template <typename T> FillColumn (const char* name, Span<T> data)               : FillColumn (name, data.data(), data.size()) {}
+
+  const char* GetName() const { return fName; }
+  std::size_t size()    const { return fSize; }
+
+protected:
+  friend Fill_iterator;
+
+  // function pointer definitions to allow access to templated code
+  typedef void* (*First_t) (Entry& entry, const char* name, const void* data, BranchValue*& ibranch);
+  typedef void  (*Copy_t)  (void* value, const void* data, std::size_t i);
+
+  template <typename T> static void* First (Entry& entry, const char* name, const void* data, BranchValue*& ibranch);
+  template <typename T> static void  Copy  (void* value, const void* data, std::size_t i) { *static_cast<T*>(value) = static_cast<const T*>(data)[i]; }
+
+  const char* fName;
+  const void* fData;
+  std::size_t fSize;
+  First_t     fFirst;
+  Copy_t      fCopy;
+};
+
+// ===========================================================================
+class TTreeIterator::Batch_iterator : public Entry_iterator {
+public:
+  Batch_iterator (TTreeIterator& treeI, Long64_t first, Long64_t last, Long64_t nbatch)
+    : Entry_iterator(treeI,first,last), fBatchSize(nbatch > 0 ? nbatch : 1), fBatch(*this) {}
+  // columns are a cache for this iterator, so don't copy them
+  Batch_iterator (const Batch_iterator& in) : Entry_iterator(in), fBatchSize(in.fBatchSize), fBatch(*this) {}
+  Batch_iterator& operator++() { fIndex = BatchEnd(); return *this; }
+  const Batch& operator*() const { return fBatch.LoadTree (fIndex, BatchEnd()); }
+
+  Batch_iterator begin() { return *this; }
+  Batch_iterator end()   { Batch_iterator it = *this; it.fIndex = fEnd; return it; }
+
+  Long64_t GetBatchSize() const { return fBatchSize; }
+
+protected:
+  friend Batch;
+  Long64_t BatchEnd() const;
+
+  const Long64_t fBatchSize;
+  mutable Batch fBatch;
+};
+
+
+// ===========================================================================
+// TTreeIterator::Batch_iterator ============================================
+// ===========================================================================
+
+inline TTreeIterator::Batch_iterator TTreeIterator::Batches (Long64_t nbatch) {
+  Long64_t last = GetTree() ? GetTree()->GetEntries() : 0;
+  if (verbose() >= 1 && last>0 && GetTree()->GetDirectory())
+    Info ("TTreeIterator", "get %lld entries from tree '%s' in file %s in batches of %lld", last, GetTree()->GetName(), GetTree()->GetDirectory()->GetName(), nbatch);
+  return Batch_iterator (*this, 0, last, nbatch);
+}
+
+
+// End of the batch starting at fIndex, stopping at the end of the current file
+inline Long64_t TTreeIterator::Batch_iterator::BatchEnd() const {
+  Long64_t last = (fEnd - fIndex > fBatchSize) ? fIndex + fBatchSize : fEnd;
+  if (fIndex >= last) return last;
+  Long64_t local = GetTree()->LoadTree (fIndex);
+  if (local < 0 || !GetTree()->GetTree()) return last;
+  Long64_t fileEnd = fIndex - local + GetTree()->GetTree()->GetEntries();
+  return (fileEnd < last) ? fileEnd : last;
+}
+
+
+// ===========================================================================
+// TTreeIterator::Batch =====================================================
+// ===========================================================================
+
+inline int            TTreeIterator::Batch::verbose() const { return fIter.verbose(); }
+inline TTreeIterator& TTreeIterator::Batch::tree()    const { return fIter.tree();    }
+inline TTree*         TTreeIterator::Batch::GetTree() const { return fIter.GetTree(); }
+
+
+template <typename T>
+inline TTreeIterator::Span<T> TTreeIterator::Batch::Get (const char* name) const {
+  static_assert (std::is_trivially_copyable<T>::value, "TTreeIterator::Batch::Get<T>() requires a trivially copyable type");
+  Column& col = GetColumn<T> (name);
+  if (col.fIndex != fIndex) {
+    col.fIndex = fIndex;
+    col.fData  = nullptr;
+    if (fSize > 0 && col.fBranch && !(col.fBulk && ReadBulk (col))) ReadEntries<T> (col);
+  }
+  return Span<T> (reinterpret_cast<const T*>(col.fData), col.fData ? fSize : 0);
+}
+
+
+inline TTreeIterator::Batch& TTreeIterator::Batch::LoadTree (Long64_t first, Long64_t last) {
+  fIndex = first;
+  fLocalIndex = GetTree()->LoadTree (first);
+  fSize = (fLocalIndex >= 0 && last > first) ? last - first : 0;
+  if (GetTree()->GetTreeNumber() != fTreeNumber) {
+    fTreeNumber = GetTree()->GetTreeNumber();
+    for (auto& col : fColumns) Bind (col);
+  }
+  return *this;
+}
+
+
+template <typename T>
+inline TTreeIterator::Batch::Column& TTreeIterator::Batch::GetColumn (const char* name) const {
+  type_code_t type = type_code<T>();
+  for (auto& col : fColumns)
+    if (col.fType == type && col.fName == name) return col;
+  fColumns.emplace_back (name, type, TDataType::GetType (typeid(T)), sizeof(T));
+  Bind (fColumns.back());
+  return fColumns.back();
+}
+
+
+// Find the branch in the current tree, and check whether we can use bulk read
+inline void TTreeIterator::Batch::Bind (Column& col) const {
+  TTree* t = GetTree()->GetTree();   // current tree in a TChain
+  col.fBranch = t ? t->GetBranch (col.fName.c_str()) : nullptr;
+  col.fBulk   = false;
+  col.fIndex  = col.fBasketFirst = col.fBasketLast = -1;
+  if (!col.fBranch) {
+    if (verbose() >= 0) tree().Error ("Batch", "branch '%s' not found", col.fName.c_str());
+    return;
+  }
+#ifndef NO_BULK_READ
+  TClass* expectedClass = 0;
+  EDataType expectedType = kOther_t;
+  col.fBulk = col.fDataType != kOther_t
+           && col.fBranch->GetBulkRead().SupportsBulkRead()
+           && !col.fBranch->GetExpectedType (expectedClass, expectedType)
+           && !expectedClass && expectedType == col.fDataType;
+#endif
+  if (verbose() >= 1) tree().Info ("Batch", "branch '%s' %s", col.fName.c_str(), (col.fBulk ? "uses bulk read" : "is read entry by entry"));
+}
+
+
+// Read the batch's values using the basket buffers. If the batch lies within a single basket, fData points
+// directly into the buffer, otherwise the values are copied into fCopy.
+inline bool TTreeIterator::Batch::ReadBulk (Column& col) const {
+  Long64_t entry = fLocalIndex, last = fLocalIndex + fSize;
+  if (!(entry >= col.fBasketFirst && entry < col.fBasketLast) && !ReadBasket (col, entry)) return false;
+  if (last <= col.fBasketLast) {
+    col.fData = col.fBasketData + (entry - col.fBasketFirst) * col.fElemSize;
+    return true;
+  }
+  col.fCopy.resize (fSize * col.fElemSize);
+  char* out = col.fCopy.data();
+  for (;;) {
+    Long64_t n = ((last < col.fBasketLast) ? last : col.fBasketLast) - entry;
+    std::memcpy (out, col.fBasketData + (entry - col.fBasketFirst) * col.fElemSize, n * col.fElemSize);
+    out   += n * col.fElemSize;
+    entry += n;
+    if (entry >= last) break;
+    if (!ReadBasket (col, entry)) return false;
+  }
+  col.fData = col.fCopy.data();
+  return true;
+}
+
+
+// Read the basket containing (local) entry into the column's buffer
+inline bool TTreeIterator::Batch::ReadBasket (Column& col, Long64_t entry) const {
+#ifndef NO_BULK_READ
+  TBranch* branch = col.fBranch;
+  Long64_t* basketEntry = branch->GetBasketEntry();
+  Long64_t first = basketEntry[TMath::BinarySearch (Long64_t(branch->GetWriteBasket()+1), basketEntry, entry)];
+  Int_t n = branch->GetBulkRead().GetBulkEntries (first, col.fBuffer);
+  if (n > 0 && first + n > entry) {
+    col.fBasketFirst = first;
+    col.fBasketLast  = first + n;
+    col.fBasketData  = col.fBuffer.GetCurrent();
+    fIter.fEntry->fTotRead += n * col.fElemSize;
+    if (verbose() >= 2) tree().Info ("Batch", "branch '%s' bulk read %d entries from entry %lld", col.fName.c_str(), n, fIndex - fLocalIndex + first);
+    return true;
+  }
+  if (verbose() >= 0) tree().Error ("Batch", "branch '%s' bulk read failed for entry %lld - read entry by entry instead", col.fName.c_str(), fIndex - fLocalIndex + entry);
+#endif
+  col.fBulk = false;
+  col.fBasketFirst = col.fBasketLast = -1;
+  return false;
+}
+
+
+// Fallback: read the batch's values one entry at a time
+template <typename T>
+inline void TTreeIterator::Batch::ReadEntries (Column& col) const {
+  col.fCopy.resize (fSize * sizeof(T));
+  char* out = col.fCopy.data();
+  Entry& entry = *fIter.fEntry;
+  for (Long64_t i = fIndex, last = fIndex + fSize; i < last; ++i, out += sizeof(T))
+    std::memcpy (out, &entry.LoadTree(i).Get<T>(col.fName.c_str()), sizeof(T));
+  col.fData = col.fCopy.data();
+}
+
+
+// ===========================================================================
+// TTreeIterator::FillColumn ================================================
+// ===========================================================================
+
+// Set the first value with Entry::Set (creating the branch if necessary), and return the address
+// of the value the branch is filled from, so subsequent values can be assigned there directly.
+template <typename T>
+inline void* TTreeIterator::FillColumn::First (Entry& entry, const char* name, const void* data, BranchValue*& ibranch) {
+  const T& value = entry.Set<T> (name, T(*static_cast<const T*>(data)));
+  ibranch = entry.GetBranchValue<T> (name);
+  if (!ibranch || !ibranch->fSet) return nullptr;
+  return const_cast<T*>(&value);
+}
+
+
+// ===========================================================================
+// TTreeIterator::Fill_iterator =============================================
+// ===========================================================================
+
+inline Long64_t TTreeIterator::FillColumns (const std::vector<FillColumn>& columns) {
+  return FillEntries().FillColumns (columns);
+}
+
+
+// Fill one entry for each value in the columns. The branches are looked up (or created) for the first entry.
+// After that, the values are assigned straight to the branch addresses, without going through
+// Entry::Set(). Returns the number of entries filled.
+inline Long64_t TTreeIterator::Fill_iterator::FillColumns (const std::vector<FillColumn>& columns) {
+  if (columns.empty() || !GetTree()) return 0;
+  std::size_t n = columns.front().fSize;
+  for (auto& col : columns) {
+    if (col.fSize == n) continue;
+    if (verbose() >= 0) tree().Error ("FillColumns", "column '%s' has %zu values, but column '%s' has %zu - only fill %zu entries",
+                                      col.fName, col.fSize, columns.front().fName, n, (col.fSize < n ? col.fSize : n));
+    if (col.fSize < n) n = col.fSize;
+  }
+  if (fEnd >= 0 && Long64_t(n) > fEnd - fIndex) n = (fEnd > fIndex) ? fEnd - fIndex : 0;
+  if (n == 0) return 0;
+
+  Entry& entry = **this;
+  std::vector<void*>        values   (columns.size(), nullptr);
+  std::vector<BranchValue*> branches (columns.size(), nullptr);
+  for (std::size_t ic = 0; ic < columns.size(); ++ic) {
+    const FillColumn& col = columns[ic];
+    values[ic] = (*col.fFirst) (entry, col.fName, col.fData, branches[ic]);
+    if (!values[ic] && verbose() >= 0) tree().Error ("FillColumns", "could not set branch '%s' - column not filled", col.fName);
+  }
+  if (verbose() >= 1) tree().Info ("FillColumns", "fill %zu entries in %zu columns from entry %lld", n, columns.size(), fIndex);
+
+  Long64_t nfilled = 0;
+  for (std::size_t i = 0; i < n; ++i, ++fIndex) {
+    if (i > 0) {
+      entry.fIndex = fIndex;
+      for (std::size_t ic = 0; ic < columns.size(); ++ic) {
+        if (!values[ic]) continue;
+        (*columns[ic].fCopy) (values[ic], columns[ic].fData, i);
+        branches[ic]->MarkSet();
+      }
+    }
+    if (entry.Fill() < 0) break;
+    ++nfilled;
+  }
+  return nfilled;
+}
+
+#endif /* ROOT_TTreeIterator_batch */
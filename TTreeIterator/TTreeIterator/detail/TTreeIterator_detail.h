@@ -5,9 +5,19 @@
 #define ROOT_TTreeIterator_detail
 
 #include <limits>
+#include "RVersion.h"
 #include "TError.h"
 #include "TFile.h"
 #include "TChain.h"
+#include "TChainElement.h"
+#include "TROOT.h"
+#include "TVirtualMutex.h"
+#include "TTreeCache.h"
+#include "TTreeCacheUnzip.h"
+
+#if !defined(NO_BACKFILL) && (ROOT_VERSION_CODE < ROOT_VERSION(6,12,0))
+# define NO_BACKFILL 1     // TBranch::BackFill() not available
+#endif
 
 // TTreeIterator ===============================================================
 
@@ -30,6 +40,7 @@ inline void TTreeIterator::Init (TDirectory* dir /* =nullptr */, bool owned/*=tr
 
 
 inline TTree* TTreeIterator::SetTree (TTree* tree) {
+  ResetBranchAddresses();
   if (fTreeOwned) delete fTree;
   fTree = tree;
   fTreeOwned = false;
@@ -37,6 +48,111 @@ inline TTree* TTreeIterator::SetTree (TTree* tree) {
 }
 
 
+// Entry for a loop ending at last. Only one Entry can set a branch's address, so this replaces the kept Entry,
+// unless keep is set and the kept Entry isn't in use, in which case that is reused with its branches still bound.
+inline std::shared_ptr<TTreeIterator::Entry> TTreeIterator::NewEntry (Long64_t last, bool keep/*=false*/) {
+  if (fEntry) {
+    if (keep && fEntry.use_count() == 1 && fEntry->CheckAddresses()) {
+      if (fEntry->fLearn == -1 && fTouchedOnly) fEntry->DisableUntouched();   // already learnt which branches we use
+      if (fEntry->fLearn == -1 && fPrefetch)    fEntry->EnableParallelUnzip();   // for the TTreeCache of each new file in a TChain
+      return fEntry;
+    }
+    if (fEntry.use_count() > 1) keep = false;   // nested loop, so the outer loop's Entry will reset the addresses when it finishes
+    ResetBranchAddresses();
+  }
+  auto entry = std::make_shared<Entry> (*this, 0, last);
+  if (keep) KeepEntry (entry);
+  return entry;
+}
+
+
+// Keep the Entry for the next loop. The Entry holds pointers to the tree's branches, so register with gROOT's
+// list of cleanups to be told (in RecursiveRemove) if the tree is deleted first.
+inline void TTreeIterator::KeepEntry (std::shared_ptr<Entry> entry) {
+  fEntry = std::move (entry);
+  if (fCleanup || !fTree) return;
+  fTree->SetBit (kMustCleanup);
+  R__LOCKGUARD (gROOTMutex);
+  gROOT->GetListOfCleanups()->Add (this);
+  fCleanup = true;
+}
+
+
+inline void TTreeIterator::ResetBranchAddresses() {
+  fEntry.reset();
+  if (!fCleanup) return;
+  R__LOCKGUARD (gROOTMutex);
+  gROOT->GetListOfCleanups()->Remove (this);
+  fCleanup = false;
+}
+
+
+// Called by ROOT when an object in the list of cleanups is deleted. If it was our tree, its branches are already gone,
+// so clear the kept Entry's branch pointers before dropping it, so ~Entry doesn't reset their addresses.
+inline void TTreeIterator::RecursiveRemove (TObject* obj) /*override*/ {
+  if (!obj || obj != fTree) return;
+  if (verbose() >= 1) Info ("TTreeIterator", "tree '%s' was deleted", GetName());
+  fTree = nullptr;
+  fTreeOwned = false;
+  if (fEntry) fEntry->TreeDeleted();
+  ResetBranchAddresses();
+}
+
+
+// Enable a branch and all its sub-branches. We enable each sub-branch by name, since SetBranchStatus("obj")
+// doesn't enable the sub-branches of a split object unless they are named "obj.*".
+inline void TTreeIterator::ActivateBranch (TBranch* branch) const {
+  fTree->SetBranchStatus (branch->GetName(), 1);
+  if (TObjArray* subbranches = branch->GetListOfBranches())
+    for (Int_t i = 0, n = subbranches->GetEntriesFast(); i < n; ++i)
+      ActivateBranch (static_cast<TBranch*>(subbranches->UncheckedAt(i)));
+}
+
+
+// Write the first nentries entries, then use their sizes to set the cluster and basket sizes. See SetAutoTune().
+// nfill is the number of entries we expect to fill in total (-1 if not known).
+inline void TTreeIterator::AutoTune (Long64_t nentries, Long64_t nfill) {
+  fTree->FlushBaskets();   // so we know the compressed size
+  Long64_t zipBytes = fTree->GetZipBytes();
+  if (nentries <= 0 || zipBytes <= 0) {
+    if (verbose() >= 0) Warning ("AutoTune", "no data written in %lld entries - cannot tune cluster or basket sizes", nentries);
+    return;
+  }
+  Long64_t clusterEntries = Long64_t (double(fAutoTuneBytes) * nentries / zipBytes);
+  if (fAutoTuneClusters > 0 && nfill > 0) {
+    Long64_t maxEntries = (nfill + fAutoTuneClusters - 1) / fAutoTuneClusters;
+    if (clusterEntries > maxEntries) clusterEntries = maxEntries;
+  }
+  if (clusterEntries < 1) clusterEntries = 1;
+  fTree->SetAutoFlush (clusterEntries);
+  Int_t nbranches = TuneBaskets (fTree->GetListOfBranches(), double(clusterEntries) / nentries);
+  if (verbose() >= 1) Info ("AutoTune", "%lld entries wrote %lld bytes: use %lld entries per cluster (~%lld bytes) and set basket sizes for %d branches",
+                            nentries, zipBytes, clusterEntries, Long64_t(double(zipBytes) * clusterEntries / nentries), nbranches);
+}
+
+
+// Set each branch's basket size to hold the (uncompressed) bytes written so far, times scale.
+// Returns the number of branches changed.
+inline Int_t TTreeIterator::TuneBaskets (TObjArray* branches, double scale) const {
+  const Long64_t minBasket = 1024, maxBasket = 256*1024*1024;   // keep well below TBuffer's 1 GB limit
+  Int_t nbranches = 0;
+  if (!branches) return nbranches;
+  for (Int_t i = 0, n = branches->GetEntriesFast(); i < n; ++i) {
+    TBranch* branch = static_cast<TBranch*>(branches->UncheckedAt(i));
+    if (Long64_t totBytes = branch->GetTotBytes()) {
+      Long64_t size = Long64_t (1.1 * scale * totBytes);   // leave 10% for entry-to-entry variation
+      if      (size < minBasket) size = minBasket;
+      else if (size > maxBasket) size = maxBasket;
+      if (verbose() >= 2) Info ("AutoTune", "branch '%s' basket size %d -> %lld", branch->GetName(), branch->GetBasketSize(), size);
+      branch->SetBasketSize (Int_t(size));
+      ++nbranches;
+    }
+    nbranches += TuneBaskets (branch->GetListOfBranches(), scale);
+  }
+  return nbranches;
+}
+
+
 // use a TChain
 inline Int_t TTreeIterator::Add (const char* name, Long64_t nentries/*=TTree::kMaxEntries*/) {
   auto chain = dynamic_cast<TChain*>(fTree);
@@ -50,6 +166,7 @@ inline Int_t TTreeIterator::Add (const char* name, Long64_t nentries/*=TTree::kM
         Warning ("Add", "cannot include %lld entries from in-memory TTree '%s' in new TChain of same name - existing in-memory TTree will be dropped",
                  fTree->GetEntriesFast(), GetName());
     }
+    ResetBranchAddresses();
     if (fTreeOwned) delete fTree;
     fTree = chain;
     fTreeOwned = true;
@@ -61,22 +178,30 @@ inline Int_t TTreeIterator::Add (const char* name, Long64_t nentries/*=TTree::kM
 
 
 inline TTreeIterator::~TTreeIterator() /*override*/ {
+  ResetBranchAddresses();   // before the tree is deleted
   if (fTreeOwned) delete fTree;
 }
 
 
 // std::iterator interface
 inline TTreeIterator::Entry_iterator TTreeIterator::begin() {
+  if (fLazyChain && dynamic_cast<TChain*>(fTree)) {
+    if (verbose() >= 1) Info ("TTreeIterator", "get entries from chain '%s' file by file", GetTree()->GetName());
+    Entry_iterator it (*this, 0, TTree::kMaxEntries, NewEntry (TTree::kMaxEntries, true));
+    it.NextFile();
+    return it;
+  }
   Long64_t last = GetTree() ? GetTree()->GetEntries() : 0;
   if (verbose() >= 1 && last>0 && GetTree()->GetDirectory())
     Info ("TTreeIterator", "get %lld entries from tree '%s' in file %s", last, GetTree()->GetName(), GetTree()->GetDirectory()->GetName());
-  return Entry_iterator (*this, 0,    last);
+  return Entry_iterator (*this, 0,    last, NewEntry (last, true));
 }
 
 
 inline TTreeIterator::Entry_iterator TTreeIterator::end()   {
+  if (fLazyChain && dynamic_cast<TChain*>(fTree)) return Entry_iterator (*this, TTree::kMaxEntries, TTree::kMaxEntries, nullptr);
   Long64_t last = GetTree() ? GetTree()->GetEntries() : 0;
-  return Entry_iterator (*this, last, last);
+  return Entry_iterator (*this, last, last, nullptr);   // no Entry needed just to compare the index
 }
 
 
@@ -185,31 +310,38 @@ inline /*static*/ const char* TTreeIterator::tname(const char* name/*=0*/) {
 }
 
 
-// TTreeIterator::Entry_iterator ===============================================
+// TTreeIterator::Entry_iterator ==============================================
 
-inline TTreeIterator::Entry_iterator::~Entry_iterator() {
-  if (verbose() >= 1) {
-#ifndef NO_BranchValue_STATS
-    if (fNhits || fNmiss)
-      tree().Info ("TTreeIterator", "GetBranchValue optimisation had %lu hits, %lu misses, %.1f%% success rate", fNhits, fNmiss, double(100*fNhits)/double(fNhits+fNmiss));
-#endif
-    if (fTotFill>0 || fTotWrite>0)
-      tree().Info ("TTreeIterator", "filled %lld bytes total; wrote %lld bytes at end", fTotFill, fTotWrite);
-    if (fTotRead>0)
-      tree().Info ("TTreeIterator", "read %lld bytes total", fTotRead);
+// For a lazy chain, called at the first entry of each file: load the file, and note where it ends.
+// If there are no more entries, move to the end.
+inline void TTreeIterator::Entry_iterator::NextFile() {
+  Long64_t local = GetTree() ? GetTree()->LoadTree (fIndex) : -1;
+  TTree* t = (local >= 0) ? GetTree()->GetTree() : nullptr;
+  if (!t) {
+    fIndex = fNextFile = fEnd;
+    return;
   }
+  fNextFile = fIndex - local + t->GetEntries();
+  if (verbose() >= 2) tree().Info ("TTreeIterator", "entries %lld - %lld are in file %s", fIndex, fNextFile-1,
+                                   t->GetCurrentFile() ? t->GetCurrentFile()->GetName() : "");
 }
 
 
+// TTreeIterator::Fill_iterator ===============================================
+
 inline Int_t TTreeIterator::Fill_iterator::Write (const char* name/*=0*/, Int_t option/*=0*/, Int_t bufsize/*=0*/) {
   Int_t nbytes = 0;
   TTree* t = GetTree();
-  if (fWriting && t && t->GetDirectory() && t->GetDirectory()->IsWritable()) {
-    nbytes = t->Write (name, option, bufsize);
-    if (nbytes>0) fTotWrite += nbytes;
+  if (!fEntry) return 0;
+  if (fEntry->fWriting && t && t->GetDirectory() && t->GetDirectory()->IsWritable()) {
+    if (TFile* merger = MergerFile (t))
+      nbytes = merger->Write (name, option, bufsize);   // sends the file to the TBufferMerger and resets the tree
+    else
+      nbytes = t->Write (name, option, bufsize);
+    if (nbytes>0) fEntry->fTotWrite += nbytes;
     if (verbose() >= 1) tree().Info ("Write", "wrote %d bytes to file %s", nbytes, t->GetDirectory()->GetName());
   }
-  fWriting = false;
+  fEntry->fWriting = false;
   return nbytes;
 }
 
@@ -217,10 +349,21 @@ inline Int_t TTreeIterator::Fill_iterator::Write (const char* name/*=0*/, Int_t
 // TTreeIterator::Entry ========================================================
 
 inline TTreeIterator::Entry::~Entry() {
+  if (verbose() >= 1) {
+#ifndef NO_BranchValue_STATS
+    if (fNhits || fNmiss)
+      tree().Info ("TTreeIterator", "GetBranchValue optimisation had %lu hits, %lu misses, %.1f%% success rate", fNhits, fNmiss, double(100*fNhits)/double(fNhits+fNmiss));
+#endif
+    if (fTotFill>0 || fTotWrite>0)
+      tree().Info ("TTreeIterator", "filled %lld bytes total; wrote %lld bytes at end", fTotFill, fTotWrite);
+    if (fTotRead>0)
+      tree().Info ("TTreeIterator", "read %lld bytes total", fTotRead);
+  }
   if (verbose() >= 1 && fBranches.size() > 0)
     tree().Info ("~Entry", "ResetAddress for %zu branches", fBranches.size());
   for (auto ibranch = fBranches.rbegin(); ibranch != fBranches.rend(); ++ibranch)
     ibranch->ResetAddress();
+  EndLoop();
 }
 
 
@@ -245,9 +388,29 @@ inline const T& TTreeIterator::Entry::Set (const char* name, T&& val, const char
 }
 
 
+template <typename T>
+inline T& TTreeIterator::Entry::Ref (const char* name) {
+  BranchValue* ibranch = GetBranchValue<T> (name);
+  if (!ibranch) {
+    Set<T> (name, type_default<T>());   // create the branch
+    ibranch = GetBranchValue<T> (name);
+  }
+  if (!ibranch || !ibranch->fSet) return default_value<T>();
+  ibranch->MarkSet();
+#ifndef OVERRIDE_BRANCH_ADDRESS
+  if (ibranch->fIsobj) {
+    if (ibranch->fPuser && *ibranch->fPuser) return **(T**)ibranch->fPuser;
+  } else {
+    if (ibranch->fPuser)                     return  *(T* )ibranch->fPuser;
+  }
+#endif
+  return ibranch->GetValue<T>();
+}
+
+
 inline Int_t TTreeIterator::Entry::GetEntry (Int_t getall/*=0*/) {
   Int_t nbytes = tree().GetEntry (fIndex, getall);
-  if (nbytes>0) iter().fTotRead += nbytes;
+  if (nbytes>0) fTotRead += nbytes;
   return nbytes;
 }
 
@@ -257,24 +420,23 @@ inline Int_t TTreeIterator::Entry::Fill() {
   if (!t) return 0;
 
 #ifndef NO_FILL_UNSET_DEFAULT
-  for (auto& b : fBranches) {
-    BranchValue* ibranch = &b;
-    if (ibranch->fSet
+  // Only a branch set in the previous entry can need resetting to its default value:
+  // any others were reset already, so we don't have to look at every branch.
+  const std::size_t nset = fSetBranches.size();
+  for (BranchValue* ibranch : fLastSetBranches) {
+    if (!ibranch->fDirty
 #ifndef OVERRIDE_BRANCH_ADDRESS
         && !ibranch->fPuser
 #endif
-       ) {
-      if (ibranch->fUnset)
-        (*ibranch->fSetDefaultValue) (ibranch);
-      else ibranch->fUnset = true;
-    }
+       )
+      (*ibranch->fSetDefaultValue) (ibranch);
   }
 #endif
 
   Int_t nbytes = t->Fill();
 
   if (nbytes >= 0) {
-    iter().fTotFill += nbytes;
+    fTotFill += nbytes;
     if (verbose() >= 2) {
       std::string allbranches = tree().BranchNamesString();
       tree().Info  ("Fill", "Filled %d bytes for entry %lld, branches: %s", nbytes, fIndex, allbranches.c_str());
@@ -286,7 +448,17 @@ inline Int_t TTreeIterator::Entry::Fill() {
     }
   }
 
-  if (nbytes > 0) iter().fWriting     = true;
+  if (nbytes > 0) fWriting = true;
+
+  if (tree().fAutoTuneBytes > 0 && t->GetEntries() == tree().fAutoTuneEntries)
+    tree().AutoTune (t->GetEntries(), fEnd);
+
+#ifndef NO_FILL_UNSET_DEFAULT
+  for (BranchValue* ibranch : fSetBranches) ibranch->fDirty = false;
+  fSetBranches.resize (nset);   // drop the branches just set to their defaults: they don't need resetting again
+  fLastSetBranches.swap (fSetBranches);
+  fSetBranches.clear();
+#endif
 
   return nbytes;
 }
@@ -316,7 +488,12 @@ inline TTreeIterator::BranchValue* TTreeIterator::Entry::GetBranch(const char* n
       return nullptr;
     } else if (TBranch* branch = GetTree()->GetBranch(name)) {
       ibranch->fBranch = branch;
+      if (fTouchedOnly) tree().ActivateBranch (branch);
       if (!ibranch->SetBranchAddress<T>()) return nullptr;
+      if (fLearn == -1) {   // TTreeCache already trained, so add this branch now
+        GetTree()->AddBranchToCache (name, true);
+        if (verbose() >= 1) tree().Info (tname<T>("Get"), "add branch '%s' to TTreeCache", name);
+      }
     } else {
       if (verbose() >= 0) tree().Error (tname<T>("Get"), "branch '%s' not found", name);
       return nullptr;
@@ -328,28 +505,32 @@ inline TTreeIterator::BranchValue* TTreeIterator::Entry::GetBranch(const char* n
 
 
 inline TTreeIterator::BranchValue* TTreeIterator::Entry::GetBranchValue (const char* name, type_code_t type) const {
-  const std::string sname = name;
   if (fTryLast) {
-    ++fLastBranch;
-    if (fLastBranch == fBranches.end()) fLastBranch = fBranches.begin();
-    BranchValue& b = *fLastBranch;
-    if (b.fType == type && b.fName == sname) {
+    if (++fLastBranch >= fBranches.size()) fLastBranch = 0;
+    BranchValue& b = fBranches[fLastBranch];
+    if (b.fType == type && b.fName == name) {
 #ifndef NO_BranchValue_STATS
-      ++iter().fNhits;
+      ++fNhits;
 #endif
       return &b;
     }
   }
-  for (auto ib = fBranches.begin(); ib != fBranches.end(); ib++) {
-    if (fTryLast && ib == fLastBranch) continue;    // already checked this one
-    BranchValue& b = *ib;
-    if (b.fType == type && b.fName == sname) {
-      fTryLast = true;
-      fLastBranch = ib;
+  if (!fBranchIndex.empty()) {
+    // Look up (name,type) in the hash table. No std::string is constructed, and the cost
+    // doesn't depend on the number of branches or the order in which they are accessed.
+    const std::size_t hash = BranchHash (name, type);
+    const std::size_t mask = fBranchIndex.size()-1;
+    for (std::size_t i = hash & mask; fBranchIndex[i]; i = (i+1) & mask) {
+      const std::size_t ib = fBranchIndex[i]-1;
+      BranchValue& b = fBranches[ib];
+      if (b.fHash == hash && b.fType == type && b.fName == name) {
+        fTryLast = true;
+        fLastBranch = ib;
 #ifndef NO_BranchValue_STATS
-      ++iter().fNmiss;
+        ++fNmiss;
 #endif
-      return &b;
+        return &b;
+      }
     }
   }
   fTryLast = false;
@@ -357,6 +538,236 @@ inline TTreeIterator::BranchValue* TTreeIterator::Entry::GetBranchValue (const c
 }
 
 
+// Add fBranches[ib...] to the fBranchIndex hash table, rebuilding it if it is more than half full.
+inline void TTreeIterator::Entry::IndexBranch (std::size_t ib) const {
+  std::size_t size = fBranchIndex.size();
+  if (2*fBranches.size() > size) {
+    size = (size ? 2*size : 64);   // must be a power of 2
+    fBranchIndex.assign (size, 0);
+    ib = 0;
+  }
+  const std::size_t mask = size-1;
+  for (; ib < fBranches.size(); ++ib) {
+    std::size_t i = fBranches[ib].fHash & mask;
+    while (fBranchIndex[i]) i = (i+1) & mask;
+    fBranchIndex[i] = ib+1;
+  }
+}
+
+
+// A TChain has moved on to a new file, so the TBranch pointers we have are for the previous TTree.
+// Update them all now. The branch addresses are kept by the TChain and set in the new TTree for us.
+inline void TTreeIterator::Entry::ChangeTree() {
+  fTreeNumber = GetTree()->GetTreeNumber();
+  if (fPreOpened.valid()) fPreOpened.get();   // the TChain has opened the file itself now, so close our copy
+  fPreOpenAt = TTree::kMaxEntries;
+  if (tree().fPreOpen >= 0.0 && dynamic_cast<TChain*>(GetTree())) {
+    if (TTree* t = GetTree()->GetTree()) fPreOpenAt = Long64_t (tree().fPreOpen * t->GetEntries());
+  }
+  if (fBranches.empty()) return;
+  if (verbose() >= 1) tree().Info ("LoadTree", "tree %d: update %zu branches", fTreeNumber, fBranches.size());
+  for (auto& b : fBranches) {
+    if (!b.fBranch) continue;
+    b.fLastGet = -1;
+    b.fBranch = GetTree()->GetBranch (b.fName.c_str());
+    if (!b.fBranch) {
+      if (verbose() >= 0) tree().Error ("LoadTree", "branch '%s' not found in tree %d", b.fName.c_str(), fTreeNumber);
+      b.fSet = false;
+    }
+  }
+}
+
+
+// Start opening the next file in the chain in a background thread, so that the file header, StreamerInfo, and
+// TTree have been read (and are in the OS or network cache) by the time the TChain gets to it.
+// TChain can't take an open TFile, so it still opens the file itself, but it should be quicker.
+inline void TTreeIterator::Entry::PreOpen() {
+  fPreOpenAt = TTree::kMaxEntries;   // only once for each file
+  auto chain = static_cast<TChain*>(GetTree());   // ChangeTree() only sets fPreOpenAt for a TChain
+  TObjArray* elements = chain->GetListOfFiles();
+  if (!elements || fTreeNumber+1 >= elements->GetEntriesFast()) return;
+  auto el = static_cast<TChainElement*>(elements->UncheckedAt (fTreeNumber+1));
+  std::string fname = el->GetTitle(), tname = el->GetName();
+  if (verbose() >= 1) tree().Info ("LoadTree", "open file %s in the background, at entry %lld (%lld)", fname.c_str(), fIndex, fLocalIndex);
+  ROOT::EnableThreadSafety();
+  fPreOpened = std::async (std::launch::async, [fname,tname]() {
+    std::unique_ptr<TFile> file (TFile::Open (fname.c_str()));
+    TTree* t = nullptr;
+    if (file && !file->IsZombie()) file->GetObject (tname.c_str(), t);
+    return file;
+  });
+}
+
+
+// Called after the first LearnEntries() entries, by when we know which branches the loop uses.
+inline void TTreeIterator::Entry::EndLearning() {
+  fLearn = -1;
+  if (tree().fTouchedOnly) DisableUntouched();
+  TrainCache();
+}
+
+
+// Before reusing a kept Entry, check its branches still have the addresses it bound. If the user has set a branch's
+// address since, read through that, as a new Entry would. Returns false if the Entry can't be reused, because an
+// address was reset, or we override user addresses.
+inline bool TTreeIterator::Entry::CheckAddresses() {
+  bool ok = true;
+  for (auto& b : fBranches) {
+    if (!b.fBranch || !b.fAddr) continue;
+    void* addr = b.fBranch->GetAddress();
+    if (addr == b.fAddr) continue;
+#ifndef OVERRIDE_BRANCH_ADDRESS
+    if (addr && !tree().fOverrideBranchAddress) {
+      if (verbose() >= 1) tree().Info ("TTreeIterator", "branch '%s' address changed from %p to %p - use new address", b.fName.c_str(), b.fAddr, addr);
+      b.fPuser   = (void**)addr;
+      b.fAddr    = addr;
+      b.fLastGet = -1;
+      continue;
+    }
+#endif
+    if (verbose() >= 1) tree().Info ("TTreeIterator", "branch '%s' address changed from %p to %p - bind a new Entry", b.fName.c_str(), b.fAddr, addr);
+    ok = false;
+  }
+  return ok;
+}
+
+
+// Disable all branches except those we have used, so a full GetEntry() only reads what we need.
+inline void TTreeIterator::Entry::DisableUntouched() {
+  if (!fTouchedOnly) {
+    fBranchStatus.clear();
+    SaveBranchStatus (GetTree()->GetListOfBranches());
+  }
+  GetTree()->SetBranchStatus ("*", 0);
+  size_t nbranches = 0;
+  for (auto& b : fBranches) {
+    if (!b.fBranch) continue;
+    tree().ActivateBranch (b.fBranch);
+    nbranches++;
+  }
+  fTouchedOnly = true;
+  if (verbose() >= 1) tree().Info ("LoadTree", "disabled all branches except the %zu we have read", nbranches);
+}
+
+
+// Record the status of each branch and sub-branch, so EnableAll() can restore the user's settings.
+inline void TTreeIterator::Entry::SaveBranchStatus (TObjArray* list) {
+  if (!list) return;
+  for (Int_t i = 0, n = list->GetEntriesFast(); i < n; ++i) {
+    TBranch* branch = static_cast<TBranch*>(list->UncheckedAt(i));
+    fBranchStatus.push_back (BranchStatus { branch->GetName(), branch, !branch->TestBit(kDoNotProcess) });
+    SaveBranchStatus (branch->GetListOfBranches());
+  }
+}
+
+
+// Restore the branch statuses from before DisableUntouched(), rather than enabling all branches,
+// so any the user disabled stay disabled. A TTree's branches are set directly, but a TChain
+// may have moved on to another file, so we go by name, which also sets the status for later files.
+inline void TTreeIterator::Entry::EnableAll() {
+  if (!fTouchedOnly || !GetTree()) return;
+  if (verbose() >= 1) tree().Info ("TTreeIterator", "restore the status of %zu branches", fBranchStatus.size());
+  if (GetTree()->GetTree() == GetTree()) {
+    for (auto& s : fBranchStatus) {
+      if (s.fActive) s.fBranch->ResetBit (kDoNotProcess);
+      else           s.fBranch->SetBit   (kDoNotProcess);
+    }
+  } else {
+    for (auto& s : fBranchStatus)
+      GetTree()->SetBranchStatus (s.fName.c_str(), s.fActive);
+  }
+  fBranchStatus.clear();
+  fTouchedOnly = false;
+}
+
+
+// Forget the branches of a deleted tree, so we don't try to reset their addresses or status
+inline void TTreeIterator::Entry::TreeDeleted() {
+  for (auto& b : fBranches) b.fBranch = nullptr;
+  fBranchStatus.clear();
+  fTouchedOnly = false;
+}
+
+
+// Restore the settings changed for the loop
+inline void TTreeIterator::Entry::EndLoop() {
+  EnableAll();
+  RestoreParallelUnzip();
+  UnfreezeCache();
+}
+
+
+// Replace the TTreeCache frozen by Where() with a new one of the same size, so later loops don't just cache
+// the predicate's branches: the new cache learns which branches the next loop uses.
+inline void TTreeIterator::Entry::UnfreezeCache() {
+  if (fLearn != -2 || fFrozenCache <= 0 || !GetTree()) return;
+  if (verbose() >= 1) tree().Info ("TTreeIterator", "replace frozen TTreeCache of %lld bytes", fFrozenCache);
+  GetTree()->SetCacheSize (0);
+  GetTree()->SetCacheSize (fFrozenCache);
+  fFrozenCache = 0;
+}
+
+
+// TTree::SetParallelUnzip() is a global setting, applying to all TTreeCaches created from now on,
+// so save the previous setting to restore at the end of the loop.
+inline void TTreeIterator::Entry::EnableParallelUnzip() {
+  if (fParallelUnzip < 0) fParallelUnzip = TTreeCacheUnzip::IsParallelUnzip() ? 1 : 0;
+  TTree::SetParallelUnzip (kTRUE);
+}
+
+
+inline void TTreeIterator::Entry::RestoreParallelUnzip() {
+  if (fParallelUnzip < 0) return;
+  if (verbose() >= 1 && !fParallelUnzip) tree().Info ("TTreeIterator", "disable parallel unzip");
+  TTree::SetParallelUnzip (fParallelUnzip > 0);
+  fParallelUnzip = -1;
+}
+
+
+// Set up the TTreeCache for the branches we read in the first LearnEntries() entries.
+// The cache is sized to hold one cluster of just those branches, so they can be read together.
+inline void TTreeIterator::Entry::TrainCache() {
+  TTree* t = GetTree()->GetTree();   // current tree in a TChain
+  if (!t || fLocalIndex < 0) return;
+  double zipPerEntry = 0.0;
+  size_t nbranches = 0;
+  for (auto& b : fBranches) {
+    if (!b.fBranch) continue;
+    Long64_t n = b.fBranch->GetEntries();
+    if (n > 0) zipPerEntry += double(b.fBranch->GetZipBytes("*")) / double(n);
+    nbranches++;
+  }
+  if (nbranches == 0 || zipPerEntry <= 0.0) return;
+  TTree::TClusterIterator clusters = t->GetClusterIterator (fLocalIndex);
+  Long64_t first = clusters.Next();
+  Long64_t nclus = clusters.GetNextEntry() - first;
+  Long64_t size  = Long64_t (1.1 * zipPerEntry * double(nclus)) + 1;   // allow a little extra for basket overheads
+  if (tree().fPrefetch) {
+    EnableParallelUnzip();         // restored at the end of the loop
+    GetTree()->SetCacheSize (0);   // delete ROOT's automatic TTreeCache, so the next one is a TTreeCacheUnzip
+  }
+  GetTree()->SetCacheSize (size);
+  for (auto& b : fBranches)
+    if (b.fBranch) GetTree()->AddBranchToCache (b.fName.c_str(), true);
+  GetTree()->StopCacheLearningPhase();
+  if (tree().fPrefetch) {
+    if (TTreeCache* cache = t->GetReadCache (t->GetCurrentFile()))
+      cache->SetEnablePrefetching (kTRUE);   // asynchronously read the next cluster while we process this one
+  }
+  if (verbose() >= 1) tree().Info ("TrainCache", "%sTTreeCache of %lld bytes for %zu branches read in %lld entries (%lld entries per cluster)",
+                                   (tree().fPrefetch ? "prefetching, parallel unzip " : ""), size, nbranches, tree().LearnEntries(), nclus);
+}
+
+
+// FNV-1a hash of the branch name, seeded with the type code
+inline /*static*/ std::size_t TTreeIterator::Entry::BranchHash (const char* name, type_code_t type) {
+  std::size_t hash = std::hash<type_code_t>() (type);
+  for (; *name; ++name)
+    hash = (hash ^ static_cast<unsigned char>(*name)) * std::size_t(1099511628211ULL);
+  return hash;
+}
+
+
 template <typename T>
 inline TTreeIterator::BranchValue* TTreeIterator::Entry::GetBranchValue (const char* name) const {
   using V = remove_cvref_t<T>;
@@ -384,7 +795,7 @@ template <typename T>
 inline TTreeIterator::BranchValue* TTreeIterator::Entry::NewBranch (const char* name, T&& val, const char* leaflist, Int_t bufsize, Int_t splitlevel) {
   using V = remove_cvref_t<T>;
   TBranch* branch = GetTree() ? GetTree()->GetBranch(name) : nullptr;
-  Long64_t nentries = (branch ? branch->GetEntries() : 0);
+  Long64_t nentries = fFillOffset + (branch ? branch->GetEntries() : 0);
   BranchValue* ibranch;
   if (index() <= nentries) {
     ibranch = SetBranchValue<T> (name, std::forward<T>(val));
@@ -435,14 +846,12 @@ inline TTreeIterator::BranchValue* TTreeIterator::Entry::NewBranch (const char*
     ibranch->fBranch = branch;
     ibranch->fSet = true;
   }
-  iter().fWriting     = true;
+  fWriting = true;
   if (index() > nentries) {
-    if (verbose() >= 1) tree().Info (tname<T>("Set"), "branch '%s' catch up %lld entries", name, index());
-    for (Long64_t i = nentries; i < index(); i++) {
-      FillBranch<T> (branch, name);
-    }
+    BackFill<T> (ibranch, index()-nentries);
     ibranch->Set<T>(std::forward<T>(val));
   }
+  if (ibranch->fSet) ibranch->MarkSet();
   return ibranch;
 }
 
@@ -450,44 +859,88 @@ inline TTreeIterator::BranchValue* TTreeIterator::Entry::NewBranch (const char*
 template <typename T>
 inline TTreeIterator::BranchValue* TTreeIterator::Entry::SetBranchValue (const char* name, T&& val) const {
   using V = remove_cvref_t<T>;
-  fBranches.reserve (200);   // when we reallocate, SetBranchAddress will be invalidated so have to fix up each time. This is ignored after the first call.
-  BranchValue* front = &fBranches.front();
-  fBranches.emplace_back (name, type_code<V>(), std::forward<T>(val), *const_cast<Entry*>(this), &BranchValue::SetDefaultValue<V>, &BranchValue::SetValueAddress<V>);
-  if (front != &fBranches.front()) SetBranchAddressAll("SetBranchValue");  // vector data() moved
-  return &fBranches.back();
+  fBranches.emplace_back (name, type_code<V>(), std::forward<T>(val), *const_cast<Entry*>(this), &BranchValue::SetDefaultValue<V>);
+  BranchValue* ibranch = &fBranches.back();
+  ibranch->fHash = BranchHash (name, ibranch->fType);
+  IndexBranch (fBranches.size()-1);
+  return ibranch;
 }
 
 
-inline void TTreeIterator::Entry::SetBranchAddressAll (const char* call) const {
-  if (verbose() >= 1) tree().Info  (call, "cache reallocated, so need to set all branch addresses again");
-  for (auto& b : fBranches) {
-    if (b.fSetValueAddress && b.fSet
-#ifndef OVERRIDE_BRANCH_ADDRESS
-        && !b.fPuser
+// Catch up a branch created after nfill entries were already filled, filling them with the type's default value.
+// The default is put in the branch's buffer once, but this still costs one TBranch call per entry, ie. O(nfill):
+// ROOT has no public API to write a run of identical entries into a basket in one go.
+// If the tree's cluster size is known, TBranch::BackFill() flushes the branch's baskets at the cluster boundaries,
+// so they line up with the other branches' baskets. Before the tree's first AutoFlush (GetAutoFlush() < 0 is a byte
+// count), the boundaries would only be estimates, which can leave many small baskets, so then we use TBranch::Fill(),
+// and the tree's AutoFlush flushes this branch along with the others. Errors are counted and reported once.
+template <typename T>
+inline Long64_t TTreeIterator::Entry::BackFill (BranchValue* ibranch, Long64_t nfill) {
+  using V = remove_cvref_t<T>;
+  const char* name = ibranch->fName.c_str();
+  TBranch* branch = ibranch->fBranch;
+#ifndef NO_BACKFILL
+  const bool aligned = GetTree()->GetAutoFlush() > 0;
+#else
+  const bool aligned = false;
 #endif
-       ) {
-      (*b.fSetValueAddress) (&b, call, true);
-    }
+  if (verbose() >= 1) tree().Info (tname<T>("Set"), "branch '%s' catch up %lld entries%s", name, nfill, (aligned ? " in whole clusters" : ""));
+  ibranch->Set<V> (type_default<V>());   // same value for all the entries
+  Long64_t nbytes = 0, nbad = 0;
+  for (Long64_t i = 0; i < nfill; i++) {
+#ifndef NO_BACKFILL
+    Int_t n = aligned ? branch->BackFill() : branch->Fill();
+#else
+    Int_t n = branch->Fill();
+#endif
+    if (n > 0) nbytes += n;
+    else       ++nbad;
   }
-}
-
-
-template <typename T>
-inline Int_t TTreeIterator::Entry::FillBranch (TBranch* branch, const char* name) {
-  Int_t nbytes = branch->Fill();
   if (nbytes > 0) {
-    iter().fTotFill += nbytes;
-    iter().fWriting = true;
-    if (verbose() >= 2) tree().Info  (tname<T>("Set"), "filled branch '%s' with %d bytes for entry %lld", name, nbytes, index());
-  } else if (nbytes == 0) {
-    if (verbose() >= 0) tree().Error (tname<T>("Set"), "no data filled in branch '%s' for entry %lld",    name,         index());
+    fTotFill += nbytes;
+    fWriting = true;
+  }
+  if (nbad > 0) {
+    if (verbose() >= 0) tree().Error (tname<T>("Set"), "failed to fill branch '%s' for %lld of the %lld entries before entry %lld", name, nbad, nfill, index());
   } else {
-    if (verbose() >= 0) tree().Error (tname<T>("Set"), "error filling branch '%s' for entry %lld",        name,         index());
+    if (verbose() >= 2) tree().Info  (tname<T>("Set"), "filled branch '%s' with %lld bytes for %lld entries",                    name, nbytes, nfill);
   }
   return nbytes;
 }
 
 
+// TTreeIterator::BranchColumn =================================================
+
+template <typename T>
+inline const T& TTreeIterator::BranchColumn<T>::operator() (const Entry& entry) const {
+  if (&entry == fEntry && entry.fGeneration == fGeneration) return **this;
+  BranchValue* ibranch = entry.GetBranch<T> (fName.c_str());  // find or create the BranchValue, and read the entry
+  fEntry      = &entry;
+  fGeneration = entry.fGeneration;
+  fBranch     = ibranch ? ibranch : entry.GetBranchValue<T> (fName.c_str());
+  if (!ibranch) return default_value<T>();
+  return ibranch->Get<T>();
+}
+
+
+template <typename T>
+inline const T& TTreeIterator::BranchColumn<T>::Set (Entry& entry, const T& val) const {
+  if (&entry == fEntry && entry.fGeneration == fGeneration && fBranch) return fBranch->Set<const T&> (val);
+  const T& ret = entry.Set<const T&> (fName.c_str(), val);   // find or create the branch
+  fEntry      = &entry;
+  fGeneration = entry.fGeneration;
+  fBranch     = entry.GetBranchValue<T> (fName.c_str());
+  return ret;
+}
+
+
+template <typename T>
+inline const T& TTreeIterator::BranchColumn<T>::operator*() const {
+  if (!fBranch || fEntry->index() < 0 || !fBranch->GetBranch()) return default_value<T>();
+  return fBranch->Get<T>();
+}
+
+
 // TTreeIterator::BranchValue ==================================================
 
 template <typename T>
@@ -502,7 +955,7 @@ template <typename T>
 inline const T& TTreeIterator::BranchValue::Set(T&& val) {
   using V = remove_cvref_t<T>;
   if (fSet) {
-    fUnset = false;
+    MarkSet();
 #ifndef OVERRIDE_BRANCH_ADDRESS
     if (!fPuser) {
 #endif
@@ -514,28 +967,15 @@ inline const T& TTreeIterator::BranchValue::Set(T&& val) {
 #endif
       } else
 #endif
-        if (!fPvalue) {
-//        if (verbose() >= 3) tree().Info (tname<T>("Set"), "branch '%s' assign value to @%p", fName.c_str(), (void*)GetValuePtr<V>());
-          return GetValue<V>() = std::forward<T>(val);
-        } else {
-          // This does std::any::emplace, which will reallocate the object if it is larger than sizeof(void*).
-          // So must adjust pvalue to point to the new address.
-          // In practice, this only occurs if PREFER_PTRPTR is defined.
-          T& setval = SetValue<T>(std::forward<T>(val));
-          if (fPvalue != &setval) {
-//          if (verbose() >= 3) tree().Info (tname<T>("Set"), "branch '%s' object address changed when set from @%p to @%p", fName.c_str(), (void*)&setval, fPvalue);
-            fPvalue = &setval;
-          }
-          return setval;
-        }
+        return AssignValue (GetValue<V>(), std::forward<T>(val));   // same address, so no need to update fPvalue
 #ifndef OVERRIDE_BRANCH_ADDRESS
     }
     if (fIsobj) {
       if (fPuser && *fPuser)
-        return **(V**)fPuser = std::forward<T>(val);
+        return AssignValue (**(V**)fPuser, std::forward<T>(val));
     } else {
       if (fPuser)
-        return  *(V* )fPuser = std::forward<T>(val);
+        return AssignValue ( *(V* )fPuser, std::forward<T>(val));
     }
 #endif
   }
@@ -543,6 +983,16 @@ inline const T& TTreeIterator::BranchValue::Set(T&& val) {
 }
 
 
+// Record that the branch was set in this entry, so Entry::Fill() doesn't reset it to the default value.
+inline void TTreeIterator::BranchValue::MarkSet() {
+#ifndef NO_FILL_UNSET_DEFAULT
+  if (fDirty) return;
+  fDirty = true;
+  fEntry.fSetBranches.push_back (this);
+#endif
+}
+
+
 inline bool TTreeIterator::BranchValue::GetBranch() const {
   if (!fSet) return false;
 #ifndef OVERRIDE_BRANCH_ADDRESS
@@ -558,7 +1008,7 @@ inline bool TTreeIterator::BranchValue::GetBranch() const {
   } else if (nread == 0) {
     if (verbose() >= 0) tree().Error ("GetBranch", "branch '%s' read %d bytes from entry %lld (%lld)",   fName.c_str(), nread, index(), entry().fLocalIndex);
   } else {
-    iter().fTotRead += nread;
+    entry().fTotRead += nread;
     if (verbose() >= 1) tree().Info  ("GetBranch", "branch '%s' read %d bytes from entry %lld (%lld)",   fName.c_str(), nread, index(), entry().fLocalIndex);
     fLastGet = index();
     return true;
@@ -624,6 +1074,7 @@ inline bool TTreeIterator::BranchValue::SetBranchAddress (const char* call/*="Ge
       }
       if   (verbose() >= 1) tree().Info  (tname<T>(call), "use branch '%s' %s existing address %p",        fName.c_str(), (fIsobj?"object":"variable"), addr);
       fPuser = (void**)addr;
+      fAddr  = addr;
       fSet = true;
       return true;
     }
@@ -651,19 +1102,16 @@ inline /*static*/ void TTreeIterator::BranchValue::SetDefaultValue (BranchValue*
 }
 
 
-// this is a static function, so we can store its address without needing a 16-byte member function pointer
 template <typename T>
-inline /*static*/ bool TTreeIterator::BranchValue::SetValueAddress (BranchValue* ibranch, const char* call, bool redo/*=false*/) {
+inline /*static*/ bool TTreeIterator::BranchValue::SetValueAddress (BranchValue* ibranch, const char* call) {
   T* pvalue= ibranch->GetValuePtr<T>();
   Int_t stat=0;
   void* addr;
   if (ibranch->fIsobj) {
     ibranch->fPvalue = pvalue;
     addr = &ibranch->fPvalue;
-    if (!redo)
-      stat = ibranch->GetTree()->SetBranchAddress (ibranch->fName.c_str(), (T**)(addr));
+    stat = ibranch->GetTree()->SetBranchAddress (ibranch->fName.c_str(), (T**)(addr));
   } else {
-    redo=false;  // only helps for objects
     addr = pvalue;
     stat = ibranch->GetTree()->SetBranchAddress (ibranch->fName.c_str(), pvalue);
   }
@@ -672,7 +1120,8 @@ inline /*static*/ bool TTreeIterator::BranchValue::SetValueAddress (BranchValue*
     ibranch->fSet = false;
     return false;
   }
-  if   (ibranch->verbose() >= 1) ibranch->tree().Info  (tname<T>(call), "set branch '%s' %s address %p%s",         ibranch->fName.c_str(), (ibranch->fIsobj?"object":"variable"), addr, (redo?" (pointer only)":""));
+  if   (ibranch->verbose() >= 1) ibranch->tree().Info  (tname<T>(call), "set branch '%s' %s address %p",           ibranch->fName.c_str(), (ibranch->fIsobj?"object":"variable"), addr);
+  ibranch->fAddr = addr;
   ibranch->fSet = true;
   return true;
 }
@@ -0,0 +1,413 @@
+// Multi-threaded processing of a TTree or TChain, using TTreeIterator::ParallelForEach().
+
+#ifndef ROOT_TTreeIterator_parallel
+#define ROOT_TTreeIterator_parallel
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <exception>
+
+#include "TROOT.h"
+#include "TChainElement.h"
+#include "RVersion.h"
+
+#if !defined(NO_BUFFER_MERGER) && (ROOT_VERSION_CODE < ROOT_VERSION(6,12,0))
+# define NO_BUFFER_MERGER 1    // TBufferMerger not available
+#endif
+#ifndef NO_BUFFER_MERGER
+# include "ROOT/TBufferMerger.hxx"
+# if ROOT_VERSION_CODE >= ROOT_VERSION(6,22,0)
+namespace buffer_merger_namespace = ::ROOT;
+# else
+namespace buffer_merger_namespace = ::ROOT::Experimental;
+# endif
+#endif
+
+// A file in the (possibly single-file) chain, so each worker can open its own copy
+struct TTreeIterator::ChainFile {
+  std::string fFile;     // file name
+  std::string fTree;     // tree name, including any subdirectory
+  Long64_t    fEntries;  // number of entries in the tree, if known
+};
+
+// Counters from each worker
+struct TTreeIterator::ParallelStats {
+  Long64_t  fEntries  = 0;
+  size_t    fUnits    = 0;
+  ULong64_t fTotRead  = 0;
+  ULong64_t fTotFill  = 0;
+  ULong64_t fTotWrite = 0;
+  size_t    fNhits    = 0;
+  size_t    fNmiss    = 0;
+};
+
+// Work-stealing scheduler for ParallelForEach. The entries in each file are split into units
+// of about unitsize entries. Each worker starts with a contiguous block of units, which it
+// processes in order. When it runs out, it steals the last unit from the worker with most left.
+class TTreeIterator::ParallelQueue {
+public:
+  // Unit of work: entries [fFirst,fLast) in a single file. Boundaries inside a file are moved back
+  // to the start of their TTree cluster by the worker, so units never share a cluster.
+  struct Unit {
+    Long64_t fFirst, fLast;
+    bool     fAlignFirst, fAlignLast;
+  };
+
+  ParallelQueue (const std::vector<ChainFile>& files, unsigned int nthreads, Long64_t unitsize);
+  bool Next (unsigned int slot, Unit& unit);
+  size_t size()   const { return fNunits; }
+  size_t steals() const { return fSteals; }
+
+protected:
+  struct Worker {
+    std::mutex       fMutex;
+    std::deque<Unit> fUnits;
+  };
+  std::vector<std::unique_ptr<Worker>> fWorkers;
+  size_t              fNunits = 0;
+  std::atomic<size_t> fSteals {0};
+};
+
+
+// ===========================================================================
+// TTreeIterator::ParallelForEach ===========================================
+// ===========================================================================
+
+// Call fn(entry) or fn(entry,slot) for every entry, using nthreads threads (0 = one per core).
+// The entries are divided into units of whole TTree clusters within a file, which are shared
+// between the threads by a work-stealing ParallelQueue, so a thread that finishes early takes
+// units from the others rather than sitting idle.
+// Each thread opens its own TChain of the same files, with its own Entry, so fn must be safe to
+// call concurrently: slot (0 <= slot < nthreads) can be used to index per-thread results. eg.
+//   std::vector<double> sum (nthreads);
+//   iter.ParallelForEach (nthreads, [&](const TTreeIterator::Entry& entry, unsigned int slot) {
+//     sum[slot] += entry.Get<double>("x");
+//   });
+// An in-memory TTree is processed in this thread. Any exception thrown by fn is rethrown here,
+// after all the threads have finished. Returns the number of entries processed.
+template <typename F>
+inline Long64_t TTreeIterator::ParallelForEach (unsigned int nthreads, F&& fn) {
+  Long64_t nentries = GetEntries();
+  if (nthreads == 0) nthreads = std::thread::hardware_concurrency();
+  if (Long64_t(nthreads) > nentries) nthreads = (nentries > 0) ? unsigned(nentries) : 1;
+  std::vector<ChainFile> files;
+  if (nthreads > 1 && !GetChainFiles (files)) {
+    if (verbose() >= 0) Warning ("ParallelForEach", "tree '%s' is not in a file, so process it in a single thread", GetName());
+    nthreads = 1;
+  }
+  if (nthreads <= 1) {
+    for (auto& entry : *this) CallEntry (fn, entry, 0u, 0);
+    return nentries;
+  }
+
+  ROOT::EnableThreadSafety();
+  const Long64_t unitsPerThread = 16;
+  ParallelQueue queue (files, nthreads, (nentries + unitsPerThread*nthreads - 1) / (unitsPerThread*nthreads));
+  if (verbose() >= 1) Info ("ParallelForEach", "process %lld entries from %zu files in %u threads, with %zu work units", nentries, files.size(), nthreads, queue.size());
+  std::vector<ParallelStats>      stats  (nthreads);
+  std::vector<std::exception_ptr> errors (nthreads);
+  std::vector<std::thread> workers;
+  workers.reserve (nthreads);
+  for (unsigned int slot = 0; slot < nthreads; ++slot) {
+    workers.emplace_back ([&,slot]() {
+      try {
+        ParallelWorker (fn, files, queue, nentries, slot, stats[slot]);
+      } catch (...) {
+        errors[slot] = std::current_exception();
+      }
+    });
+  }
+  for (auto& w : workers) w.join();
+
+  ParallelStats total;
+  for (auto& s : stats) {
+    total.fEntries += s.fEntries;
+    total.fUnits   += s.fUnits;
+    total.fTotRead += s.fTotRead;
+    total.fNhits   += s.fNhits;
+    total.fNmiss   += s.fNmiss;
+  }
+  if (verbose() >= 1) {
+#ifndef NO_BranchValue_STATS
+    if (total.fNhits || total.fNmiss)
+      Info ("ParallelForEach", "GetBranchValue optimisation had %lu hits, %lu misses, %.1f%% success rate", total.fNhits, total.fNmiss, double(100*total.fNhits)/double(total.fNhits+total.fNmiss));
+#endif
+    Info ("ParallelForEach", "processed %lld entries in %u threads (%zu units, %zu stolen); read %lld bytes total", total.fEntries, nthreads, total.fUnits, queue.steals(), total.fTotRead);
+  }
+  for (auto& e : errors)
+    if (e) std::rethrow_exception (e);
+  return total.fEntries;
+}
+
+
+// Process units from the queue until there are none left, using a new TChain and a single Entry
+template <typename F>
+inline void TTreeIterator::ParallelWorker (F& fn, const std::vector<ChainFile>& files, ParallelQueue& queue, Long64_t nentries,
+                                           unsigned int slot, ParallelStats& stats) const {
+  TChain chain (GetName(), GetTitle());
+  for (auto& f : files) chain.AddFile (f.fFile.c_str(), f.fEntries, f.fTree.c_str());
+  TTreeIterator iter (&chain, verbose());
+  iter.SetLearnEntries (fLearnEntries);
+  iter.SetTouchedOnly  (fTouchedOnly);
+
+  Entry_iterator it (iter, 0, nentries);
+  ParallelQueue::Unit unit;
+  while (queue.Next (slot, unit)) {
+    Long64_t first = unit.fAlignFirst ? iter.ClusterStart (unit.fFirst) : unit.fFirst;
+    Long64_t last  = unit.fAlignLast  ? iter.ClusterStart (unit.fLast)  : unit.fLast;
+    if (verbose() >= 2) Info ("ParallelForEach", "thread %u processes entries %lld - %lld", slot, first, last-1);
+    for (it.fIndex = first; it.fIndex < last; ++it) CallEntry (fn, *it, slot, 0);
+    stats.fEntries += last - first;
+    stats.fUnits++;
+  }
+
+  Entry& entry = *it.fEntry;
+  stats.fTotRead = entry.fTotRead;
+#ifndef NO_BranchValue_STATS
+  stats.fNhits   = entry.fNhits;
+  stats.fNmiss   = entry.fNmiss;
+#endif
+  entry.fTotRead = 0;    // already counted
+}
+
+
+// ===========================================================================
+// TTreeIterator::ParallelFill ==============================================
+// ===========================================================================
+
+// Fill nfill entries into tree treename in a new file, using nthreads threads (0 = one per core).
+// fn(entry) or fn(entry,slot) is called for each entry, just as in a FillEntries() loop, eg.
+//   TTreeIterator::ParallelFill ("out.root", "tree", 1000000, nthreads, [&](TTreeIterator::Entry& entry, unsigned int slot) {
+//     entry["x"] = gen[slot].Gaus();
+//     entry.Fill();
+//   });
+// Each thread fills its own TTree in a TBufferMergerFile, and sends it to the TBufferMerger to be
+// merged into the output file whenever the tree has written some baskets (ie. at autoflush) and
+// at the end. Entries are handed out to the threads one at a time, so the order in the output
+// file is not defined, and entry.index() counts the entries filled by this thread.
+// Any exception thrown by fn is rethrown here, after all the threads have finished.
+// Returns the number of entries processed.
+template <typename F>
+inline /*static*/ Long64_t TTreeIterator::ParallelFill (const char* filename, const char* treename, Long64_t nfill, unsigned int nthreads, F&& fn, int verbose/*=0*/) {
+#ifndef NO_BUFFER_MERGER
+  if (nthreads == 0) nthreads = std::thread::hardware_concurrency();
+  if (nthreads == 0) nthreads = 1;
+  ROOT::EnableThreadSafety();
+  buffer_merger_namespace::TBufferMerger merger (filename, "RECREATE");
+  if (verbose >= 1) ::Info ("TTreeIterator::ParallelFill", "fill %lld entries into tree '%s' in file %s in %u threads", nfill, treename, filename, nthreads);
+
+  std::atomic<Long64_t>           next {0};
+  std::vector<ParallelStats>      stats  (nthreads);
+  std::vector<std::exception_ptr> errors (nthreads);
+  std::vector<std::thread> workers;
+  workers.reserve (nthreads);
+  for (unsigned int slot = 0; slot < nthreads; ++slot) {
+    workers.emplace_back ([&,slot]() {
+      try {
+        auto file = merger.GetFile();
+        TTreeIterator iter (treename, file.get(), verbose);
+        if (!iter.GetTree()) return;
+        Fill_iterator it = iter.FillEntries();
+        Long64_t end = file->GetEND();
+        for (; next++ < nfill; ++it) {
+          if (file->GetEND() > end) {   // tree flushed some baskets, so send them to be merged
+            it.Write();                 // this also resets the tree, so its entries now start at fIndex
+            it.fEntry->fFillOffset = it.fIndex - iter.GetTree()->GetEntriesFast();
+            end = file->GetEND();
+          }
+          CallEntry (fn, *it, slot, 0);
+          stats[slot].fEntries++;
+        }
+        it.Write();
+        stats[slot].fTotFill  = it.fEntry->fTotFill;
+        stats[slot].fTotWrite = it.fEntry->fTotWrite;
+        it.fEntry->fTotFill = it.fEntry->fTotWrite = 0;   // already counted
+      } catch (...) {
+        errors[slot] = std::current_exception();
+      }
+    });
+  }
+  for (auto& w : workers) w.join();
+
+  ParallelStats total;
+  for (auto& s : stats) {
+    total.fEntries  += s.fEntries;
+    total.fTotFill  += s.fTotFill;
+    total.fTotWrite += s.fTotWrite;
+  }
+  if (verbose >= 1) ::Info ("TTreeIterator::ParallelFill", "processed %lld entries in %u threads; filled %lld bytes total; wrote %lld bytes",
+                            total.fEntries, nthreads, total.fTotFill, total.fTotWrite);
+  for (auto& e : errors)
+    if (e) std::rethrow_exception (e);
+  return total.fEntries;
+#else
+  ::Error ("TTreeIterator::ParallelFill", "TBufferMerger is not available, so can't fill %s in parallel", filename);
+  return 0;
+#endif
+}
+
+
+// Returns the tree's file if it is a TBufferMergerFile
+inline /*static*/ TFile* TTreeIterator::MergerFile (TTree* tree) {
+#ifndef NO_BUFFER_MERGER
+  return dynamic_cast<buffer_merger_namespace::TBufferMergerFile*> (tree->GetCurrentFile());
+#else
+  return nullptr;
+#endif
+}
+
+
+// ===========================================================================
+// TTreeIterator::ParallelQueue =============================================
+// ===========================================================================
+
+inline TTreeIterator::ParallelQueue::ParallelQueue (const std::vector<ChainFile>& files, unsigned int nthreads, Long64_t unitsize) {
+  if (unitsize < 1) unitsize = 1;
+  std::vector<Unit> units;
+  Long64_t offset = 0;
+  for (auto& f : files) {
+    for (Long64_t first = 0; first < f.fEntries; first += unitsize) {
+      Long64_t last = (f.fEntries - first > unitsize) ? first + unitsize : f.fEntries;
+      units.push_back ({offset+first, offset+last, first > 0, last < f.fEntries});
+    }
+    offset += f.fEntries;
+  }
+  fNunits = units.size();
+  for (unsigned int slot = 0; slot < nthreads; ++slot) {
+    fWorkers.emplace_back (new Worker);
+    fWorkers.back()->fUnits.assign (units.begin() + (fNunits*slot)/nthreads, units.begin() + (fNunits*(slot+1))/nthreads);
+  }
+}
+
+
+// Take the next unit from our own queue, or else steal the last unit from the worker with most left.
+// Returns false when there is nothing left to do.
+inline bool TTreeIterator::ParallelQueue::Next (unsigned int slot, Unit& unit) {
+  {
+    Worker& own = *fWorkers[slot];
+    std::lock_guard<std::mutex> lock (own.fMutex);
+    if (!own.fUnits.empty()) {
+      unit = own.fUnits.front();
+      own.fUnits.pop_front();
+      return true;
+    }
+  }
+  for (;;) {
+    Worker* victim = nullptr;
+    size_t  most   = 0;
+    for (auto& w : fWorkers) {
+      std::lock_guard<std::mutex> lock (w->fMutex);
+      if (w->fUnits.size() > most) {
+        most   = w->fUnits.size();
+        victim = w.get();
+      }
+    }
+    if (!victim) return false;   // units are never added, so we are done
+    std::lock_guard<std::mutex> lock (victim->fMutex);
+    if (victim->fUnits.empty()) continue;   // another thread got there first
+    unit = victim->fUnits.back();
+    victim->fUnits.pop_back();
+    ++fSteals;
+    return true;
+  }
+}
+
+
+// ===========================================================================
+// TTreeIterator::PrescanChain ==============================================
+// ===========================================================================
+
+// Open the files of a TChain in nthreads threads (0 = one per core), to read their numbers of entries (and StreamerInfo)
+// concurrently, then add them back to the chain with these numbers, so GetEntries() doesn't have to open each file in turn.
+// Empty files are dropped. Files that can't be opened are left for the TChain to report when it gets to them.
+// This resets the chain, so should be called before setting any branch status, eg.
+//   TTreeIterator iter ("tree");
+//   iter.Add ("data/*.root");
+//   iter.PrescanChain();
+// Returns the total number of entries.
+inline Long64_t TTreeIterator::PrescanChain (unsigned int nthreads/*=0*/) {
+  auto chain = dynamic_cast<TChain*>(fTree);
+  std::vector<ChainFile> files;
+  if (!chain || !GetChainFiles (files)) return GetEntries();
+  if (nthreads == 0) nthreads = std::thread::hardware_concurrency();
+  if (nthreads > files.size()) nthreads = files.size();
+  if (nthreads == 0) nthreads = 1;
+  if (verbose() >= 1) Info ("PrescanChain", "open %zu files of chain '%s' in %u threads", files.size(), chain->GetName(), nthreads);
+
+  ROOT::EnableThreadSafety();
+  std::atomic<size_t> next {0};
+  std::vector<std::thread> workers;
+  workers.reserve (nthreads);
+  for (unsigned int slot = 0; slot < nthreads; ++slot) {
+    workers.emplace_back ([&]() {
+      for (size_t i; (i = next++) < files.size();) {
+        ChainFile& f = files[i];
+        f.fEntries = TTree::kMaxEntries;   // not known
+        std::unique_ptr<TFile> file (TFile::Open (f.fFile.c_str()));
+        if (!file || file->IsZombie()) continue;
+        TTree* t = nullptr;
+        file->GetObject (f.fTree.c_str(), t);
+        if (t) f.fEntries = t->GetEntries();
+      }
+    });
+  }
+  for (auto& w : workers) w.join();
+
+  ResetBranchAddresses();
+  chain->Reset();
+  Long64_t nentries = 0;
+  for (auto& f : files) {
+    if (f.fEntries == 0) {
+      if (verbose() >= 1) Info ("PrescanChain", "drop file %s, which has no entries in tree '%s'", f.fFile.c_str(), f.fTree.c_str());
+      continue;
+    }
+    if (f.fEntries == TTree::kMaxEntries) {
+      if (verbose() >= 0) Warning ("PrescanChain", "could not read tree '%s' from file %s", f.fTree.c_str(), f.fFile.c_str());
+    } else {
+      nentries += f.fEntries;
+    }
+    chain->AddFile (f.fFile.c_str(), f.fEntries, f.fTree.c_str());
+  }
+  if (verbose() >= 1) Info ("PrescanChain", "chain '%s' has %lld entries", chain->GetName(), nentries);
+  return nentries;
+}
+
+
+// List the files (and the tree name in each file) that make up this tree or chain.
+// Returns false if the tree isn't in a file.
+inline bool TTreeIterator::GetChainFiles (std::vector<ChainFile>& files) const {
+  if (auto chain = dynamic_cast<TChain*>(fTree)) {
+    const Long64_t* offsets = chain->GetTreeOffset();   // all filled in by GetEntries()
+    TObjArray* elements = chain->GetListOfFiles();
+    if (!elements) return false;
+    for (Int_t i = 0, n = elements->GetEntriesFast(); i < n; ++i) {
+      auto el = static_cast<TChainElement*>(elements->UncheckedAt(i));
+      Long64_t ne = (offsets && i+1 <= chain->GetNtrees()) ? offsets[i+1]-offsets[i] : TTree::kMaxEntries;
+      files.push_back ({el->GetTitle(), el->GetName(), ne});
+    }
+    return !files.empty();
+  }
+  TFile*      file = fTree ? fTree->GetCurrentFile() : nullptr;
+  TDirectory* dir  = fTree ? fTree->GetDirectory()   : nullptr;
+  if (!file || !dir) return false;
+  std::string path = dir->GetPath(), top = file->GetPath();   // eg. "file.root:/subdir" and "file.root:/"
+  std::string tname = (path.compare (0, top.size(), top) == 0) ? path.substr (top.size()) : "";
+  if (!tname.empty()) tname += '/';
+  tname += fTree->GetName();
+  files.push_back ({file->GetName(), tname, fTree->GetEntries()});
+  return true;
+}
+
+
+// First entry of the cluster containing entry
+inline Long64_t TTreeIterator::ClusterStart (Long64_t entry) const {
+  if (!fTree || entry <= 0) return 0;
+  Long64_t local = fTree->LoadTree (entry);
+  TTree* t = fTree->GetTree();   // current tree in a TChain
+  if (local < 0 || !t) return entry;
+  return entry - local + t->GetClusterIterator(local).GetStartEntry();
+}
+
+#endif /* ROOT_TTreeIterator_parallel */
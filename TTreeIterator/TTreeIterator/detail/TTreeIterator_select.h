@@ -0,0 +1,389 @@
+// Entry selections, made by TTreeIterator::Filter() and looped over with TTreeIterator::Select().
+
+#ifndef ROOT_TTreeIterator_select
+#define ROOT_TTreeIterator_select
+
+#include <algorithm>
+#include <iterator>
+
+// ===========================================================================
+// A set of entry numbers, eg. those passing a cut, stored as a compressed bitmap. eg.
+//   auto central = iter.Filter ([](const TTreeIterator::Entry& e) { return std::abs(e.Get<double>("eta")) < 2.5; });
+//   auto highpt  = iter.Filter ([](const TTreeIterator::Entry& e) { return e.Get<double>("pt") > 100.0; });
+//   for (auto& entry : iter.Select (central & highpt)) ...
+// Like a Roaring bitmap, the entries are divided into blocks of 65536, according to their upper bits.
+// A block is only stored if it has any entries. If it has up to 4096 entries, it holds a sorted array
+// of their lower 16 bits. Otherwise, it holds a bitmap of all 65536. So a selection takes at most
+// 2 bytes per entry, or 1 bit per entry in the range, whichever is less. Intersection (&), union (|),
+// and difference (-, ie. AND NOT) work a block at a time, and looping over the entries skips empty blocks.
+class TTreeIterator::Selection {
+protected:
+  struct Container;
+public:
+  class const_iterator
+    : public std::iterator< std::forward_iterator_tag, Long64_t, Long64_t, const Long64_t*, Long64_t >
+  {
+  public:
+    const_iterator() {}   // end()
+    const_iterator (const std::vector<Container>& containers) : fContainers(&containers) { Enter(); Next(); }
+    Long64_t operator*() const { return fEntry; }
+    const_iterator& operator++() { Next(); return *this; }
+    const_iterator  operator++(int) { const_iterator it = *this; Next(); return it; }
+    bool operator== (const const_iterator& other) const { return fEntry == other.fEntry; }
+    bool operator!= (const const_iterator& other) const { return fEntry != other.fEntry; }
+  protected:
+    void Enter();
+    void Next();
+    const std::vector<Container>* fContainers = nullptr;
+    std::size_t fIc    = 0;   // current container
+    std::size_t fPos   = 0;   // next array element, or current bitmap word
+    ULong64_t   fWord  = 0;   // bits of the current bitmap word that we haven't returned yet
+    Long64_t    fEntry = -1;  // current entry, or -1 at the end
+  };
+
+  void Add (Long64_t entry);   // fastest if entries are added in increasing order
+  bool Contains (Long64_t entry) const;
+  Long64_t size() const;
+  bool empty() const { return fContainers.empty(); }
+  void clear() { fContainers.clear(); }
+
+  Selection& operator&= (const Selection& other);
+  Selection& operator|= (const Selection& other);
+  Selection& operator-= (const Selection& other);   // AND NOT
+  Selection  operator&  (const Selection& other) const { Selection s(*this); return s &= other; }
+  Selection  operator|  (const Selection& other) const { Selection s(*this); return s |= other; }
+  Selection  operator-  (const Selection& other) const { Selection s(*this); return s -= other; }
+
+  const_iterator begin() const { return const_iterator (fContainers); }
+  const_iterator end()   const { return const_iterator();             }
+
+protected:
+  static const UInt_t kWords    = 65536/64;   // words in a bitmap
+  static const UInt_t kMaxArray = 4096;       // more entries than this use a bitmap (which is then smaller)
+
+  struct Container {
+    explicit Container (Long64_t key) : fKey(key) {}
+    bool IsBitmap()       const { return !fBits.empty(); }
+    bool Test (UInt_t v)  const { return (fBits[v>>6] >> (v&63)) & 1; }
+    Long64_t               fKey;      // entry >> 16
+    UInt_t                 fCard = 0; // number of entries
+    std::vector<UShort_t>  fArray;    // sorted lower 16 bits of each entry, if there are up to kMaxArray
+    std::vector<ULong64_t> fBits;     // otherwise, a bitmap of kWords words
+  };
+
+  static Container And    (const Container& a, const Container& b);
+  static Container Or     (const Container& a, const Container& b);
+  static Container AndNot (const Container& a, const Container& b);
+  static void ToBitmap (Container& c);
+  static void Optimize (Container& c);
+  static UInt_t Popcount (ULong64_t w);
+  static UInt_t Ctz      (ULong64_t w);
+
+  std::vector<Container> fContainers;   // sorted by fKey
+};
+
+// ===========================================================================
+// Loop over the entries in a Selection, returned by TTreeIterator::Select().
+// A temporary Selection (eg. iter.Select (central & highpt)) is moved into the iterator, so lives until the end of
+// the loop. A named Selection isn't copied, so must stay valid (and unchanged) until the end of the loop.
+class TTreeIterator::Select_iterator : public Entry_iterator {
+public:
+  Select_iterator (TTreeIterator& treeI, Long64_t last, std::shared_ptr<const Selection> sel)
+    : Entry_iterator(treeI,0,last,treeI.NewEntry(last,true)), fSel(std::move(sel)), fPos(fSel->begin()) { Update(); }   // keep the Entry, like begin()
+  Select_iterator& operator++() { ++fPos; Update(); return *this; }
+  Select_iterator  operator++(int) { Select_iterator it = *this; ++*this; return it; }
+
+  Select_iterator begin() { return *this; }
+  Select_iterator end()   { Select_iterator it = *this; it.fIndex = fEnd; return it; }
+
+protected:
+  void Update() { fIndex = (*fPos >= 0 && *fPos < fEnd) ? *fPos : fEnd; }   // *fPos is -1 at the end of the Selection
+  std::shared_ptr<const Selection> fSel;   // shared by all copies, so fPos stays valid
+  Selection::const_iterator fPos;
+};
+
+
+// ===========================================================================
+// TTreeIterator::Filter/Select =============================================
+// ===========================================================================
+
+// Selection of the entries for which pred(entry) returns true
+template <typename F>
+inline TTreeIterator::Selection TTreeIterator::Filter (F&& pred) {
+  Selection sel;
+  for (auto& entry : *this)
+    if (pred (entry)) sel.Add (entry.index());
+  if (verbose() >= 1) Info ("Filter", "selected %lld of %lld entries", sel.size(), GetEntries());
+  return sel;
+}
+
+
+// Selection of the entries in within for which pred(entry) returns true. pred is only called for these entries.
+template <typename F>
+inline TTreeIterator::Selection TTreeIterator::Filter (const Selection& within, F&& pred) {
+  Selection sel;
+  for (auto& entry : Select (within))
+    if (pred (entry)) sel.Add (entry.index());
+  if (verbose() >= 1) Info ("Filter", "selected %lld of %lld entries", sel.size(), within.size());
+  return sel;
+}
+
+
+// Loop over a named Selection, without copying it
+inline TTreeIterator::Select_iterator TTreeIterator::Select (const Selection& sel) {
+  return SelectImpl (std::shared_ptr<const Selection> (&sel, [](const Selection*) {}));   // not owned
+}
+
+
+// Loop over a temporary Selection, which is kept until the end of the loop
+inline TTreeIterator::Select_iterator TTreeIterator::Select (Selection&& sel) {
+  return SelectImpl (std::make_shared<const Selection> (std::move (sel)));
+}
+
+
+inline TTreeIterator::Select_iterator TTreeIterator::SelectImpl (std::shared_ptr<const Selection> sel) {
+  Long64_t last = GetTree() ? GetTree()->GetEntries() : 0;
+  if (verbose() >= 1 && last>0 && GetTree()->GetDirectory())
+    Info ("TTreeIterator", "get %lld selected entries from tree '%s' in file %s", sel->size(), GetTree()->GetName(), GetTree()->GetDirectory()->GetName());
+  return Select_iterator (*this, last, std::move (sel));
+}
+
+
+// ===========================================================================
+// TTreeIterator::Selection =================================================
+// ===========================================================================
+
+inline void TTreeIterator::Selection::Add (Long64_t entry) {
+  const Long64_t key = entry >> 16;
+  const UShort_t low = UShort_t (entry & 0xffff);
+  if (fContainers.empty() || fContainers.back().fKey < key) fContainers.emplace_back (key);
+  auto ic = fContainers.end()-1;
+  if (ic->fKey != key) {
+    ic = std::lower_bound (fContainers.begin(), fContainers.end(), key, [](const Container& c, Long64_t k) { return c.fKey < k; });
+    if (ic->fKey != key) ic = fContainers.emplace (ic, key);
+  }
+  Container& c = *ic;
+  if (c.IsBitmap()) {
+    ULong64_t& word = c.fBits[low>>6];
+    const ULong64_t bit = ULong64_t(1) << (low&63);
+    if (!(word & bit)) {
+      word |= bit;
+      ++c.fCard;
+    }
+    return;
+  }
+  if (c.fArray.empty() || c.fArray.back() < low) {
+    c.fArray.push_back (low);
+  } else {
+    auto it = std::lower_bound (c.fArray.begin(), c.fArray.end(), low);
+    if (*it == low) return;
+    c.fArray.insert (it, low);
+  }
+  if (++c.fCard > kMaxArray) ToBitmap (c);
+}
+
+
+inline bool TTreeIterator::Selection::Contains (Long64_t entry) const {
+  const Long64_t key = entry >> 16;
+  const UShort_t low = UShort_t (entry & 0xffff);
+  auto ic = std::lower_bound (fContainers.begin(), fContainers.end(), key, [](const Container& c, Long64_t k) { return c.fKey < k; });
+  if (ic == fContainers.end() || ic->fKey != key) return false;
+  if (ic->IsBitmap()) return ic->Test (low);
+  return std::binary_search (ic->fArray.begin(), ic->fArray.end(), low);
+}
+
+
+inline Long64_t TTreeIterator::Selection::size() const {
+  Long64_t n = 0;
+  for (auto& c : fContainers) n += c.fCard;
+  return n;
+}
+
+
+inline TTreeIterator::Selection& TTreeIterator::Selection::operator&= (const Selection& other) {
+  std::vector<Container> out;
+  auto a = fContainers.begin();
+  auto b = other.fContainers.begin();
+  while (a != fContainers.end() && b != other.fContainers.end()) {
+    if      (a->fKey < b->fKey) ++a;
+    else if (b->fKey < a->fKey) ++b;
+    else {
+      Container c = And (*a++, *b++);
+      if (c.fCard) out.push_back (std::move(c));
+    }
+  }
+  fContainers.swap (out);
+  return *this;
+}
+
+
+inline TTreeIterator::Selection& TTreeIterator::Selection::operator|= (const Selection& other) {
+  std::vector<Container> out;
+  out.reserve (fContainers.size() + other.fContainers.size());
+  auto a = fContainers.begin();
+  auto b = other.fContainers.begin();
+  while (a != fContainers.end() || b != other.fContainers.end()) {
+    if      (b == other.fContainers.end() || (a != fContainers.end() && a->fKey < b->fKey)) out.push_back (std::move(*a++));
+    else if (a == fContainers.end()       || b->fKey < a->fKey)                              out.push_back (*b++);
+    else                                                                                      out.push_back (Or (*a++, *b++));
+  }
+  fContainers.swap (out);
+  return *this;
+}
+
+
+inline TTreeIterator::Selection& TTreeIterator::Selection::operator-= (const Selection& other) {
+  std::vector<Container> out;
+  auto b = other.fContainers.begin();
+  for (auto& a : fContainers) {
+    while (b != other.fContainers.end() && b->fKey < a.fKey) ++b;
+    if (b == other.fContainers.end() || b->fKey != a.fKey) {
+      out.push_back (std::move(a));
+    } else {
+      Container c = AndNot (a, *b);
+      if (c.fCard) out.push_back (std::move(c));
+    }
+  }
+  fContainers.swap (out);
+  return *this;
+}
+
+
+inline /*static*/ TTreeIterator::Selection::Container TTreeIterator::Selection::And (const Container& a, const Container& b) {
+  Container c (a.fKey);
+  if (a.IsBitmap() && b.IsBitmap()) {
+    c.fBits.resize (kWords);
+    for (UInt_t i = 0; i < kWords; ++i) c.fCard += Popcount (c.fBits[i] = a.fBits[i] & b.fBits[i]);
+  } else if (a.IsBitmap() || b.IsBitmap()) {
+    const Container& arr = a.IsBitmap() ? b : a;
+    const Container& bm  = a.IsBitmap() ? a : b;
+    for (UShort_t v : arr.fArray)
+      if (bm.Test (v)) c.fArray.push_back (v);
+    c.fCard = c.fArray.size();
+  } else {
+    std::set_intersection (a.fArray.begin(), a.fArray.end(), b.fArray.begin(), b.fArray.end(), std::back_inserter (c.fArray));
+    c.fCard = c.fArray.size();
+  }
+  Optimize (c);
+  return c;
+}
+
+
+inline /*static*/ TTreeIterator::Selection::Container TTreeIterator::Selection::Or (const Container& a, const Container& b) {
+  if (!a.IsBitmap() && !b.IsBitmap()) {
+    Container c (a.fKey);
+    c.fArray.reserve (a.fArray.size() + b.fArray.size());
+    std::set_union (a.fArray.begin(), a.fArray.end(), b.fArray.begin(), b.fArray.end(), std::back_inserter (c.fArray));
+    c.fCard = c.fArray.size();
+    Optimize (c);
+    return c;
+  }
+  Container c = a.IsBitmap() ? a : b;
+  const Container& other = a.IsBitmap() ? b : a;
+  if (other.IsBitmap()) {
+    for (UInt_t i = 0; i < kWords; ++i) c.fBits[i] |= other.fBits[i];
+  } else {
+    for (UShort_t v : other.fArray) c.fBits[v>>6] |= ULong64_t(1) << (v&63);
+  }
+  c.fCard = 0;
+  for (ULong64_t w : c.fBits) c.fCard += Popcount (w);
+  return c;
+}
+
+
+inline /*static*/ TTreeIterator::Selection::Container TTreeIterator::Selection::AndNot (const Container& a, const Container& b) {
+  Container c (a.fKey);
+  if (a.IsBitmap()) {
+    c.fBits = a.fBits;
+    if (b.IsBitmap()) {
+      for (UInt_t i = 0; i < kWords; ++i) c.fBits[i] &= ~b.fBits[i];
+    } else {
+      for (UShort_t v : b.fArray) c.fBits[v>>6] &= ~(ULong64_t(1) << (v&63));
+    }
+    for (ULong64_t w : c.fBits) c.fCard += Popcount (w);
+  } else if (b.IsBitmap()) {
+    for (UShort_t v : a.fArray)
+      if (!b.Test (v)) c.fArray.push_back (v);
+    c.fCard = c.fArray.size();
+  } else {
+    std::set_difference (a.fArray.begin(), a.fArray.end(), b.fArray.begin(), b.fArray.end(), std::back_inserter (c.fArray));
+    c.fCard = c.fArray.size();
+  }
+  Optimize (c);
+  return c;
+}
+
+
+inline /*static*/ void TTreeIterator::Selection::ToBitmap (Container& c) {
+  c.fBits.assign (kWords, 0);
+  for (UShort_t v : c.fArray) c.fBits[v>>6] |= ULong64_t(1) << (v&63);
+  std::vector<UShort_t>().swap (c.fArray);
+}
+
+
+// Use whichever of array or bitmap is smaller
+inline /*static*/ void TTreeIterator::Selection::Optimize (Container& c) {
+  if (!c.IsBitmap()) {
+    if (c.fCard > kMaxArray) ToBitmap (c);
+  } else if (c.fCard <= kMaxArray) {
+    c.fArray.reserve (c.fCard);
+    for (UInt_t i = 0; i < kWords; ++i)
+      for (ULong64_t w = c.fBits[i]; w; w &= w-1)
+        c.fArray.push_back (UShort_t ((i<<6) | Ctz (w)));
+    std::vector<ULong64_t>().swap (c.fBits);
+  }
+}
+
+
+inline /*static*/ UInt_t TTreeIterator::Selection::Popcount (ULong64_t w) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll (w);
+#else
+  UInt_t n = 0;
+  for (; w; w &= w-1) ++n;
+  return n;
+#endif
+}
+
+
+// Number of trailing zero bits (w must be non-zero)
+inline /*static*/ UInt_t TTreeIterator::Selection::Ctz (ULong64_t w) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll (w);
+#else
+  UInt_t n = 0;
+  for (; !(w & 1); w >>= 1) ++n;
+  return n;
+#endif
+}
+
+
+// Start at the beginning of container fIc
+inline void TTreeIterator::Selection::const_iterator::Enter() {
+  fPos  = 0;
+  fWord = (fIc < fContainers->size() && (*fContainers)[fIc].IsBitmap()) ? (*fContainers)[fIc].fBits[0] : 0;
+}
+
+
+// Move to the next entry, going on to the next container when this one is done
+inline void TTreeIterator::Selection::const_iterator::Next() {
+  for (; fIc < fContainers->size(); ++fIc, Enter()) {
+    const Container& c = (*fContainers)[fIc];
+    if (!c.IsBitmap()) {
+      if (fPos < c.fArray.size()) {
+        fEntry = (c.fKey << 16) | c.fArray[fPos++];
+        return;
+      }
+    } else {
+      while (!fWord && ++fPos < kWords) fWord = c.fBits[fPos];
+      if (fWord) {
+        fEntry = (c.fKey << 16) | (Long64_t(fPos) << 6) | Ctz (fWord);
+        fWord &= fWord-1;
+        return;
+      }
+    }
+  }
+  fEntry = -1;
+}
+
+#endif /* ROOT_TTreeIterator_select */
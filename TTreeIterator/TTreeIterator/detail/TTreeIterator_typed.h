@@ -0,0 +1,242 @@
+// Statically-typed front end for TTreeIterator, with branch names and types fixed at compile time.
+
+#ifndef ROOT_TTreeIterator_typed
+#define ROOT_TTreeIterator_typed
+
+#include <tuple>
+#include <type_traits>
+
+// Define a TTreeIterator::Field for branch NAME of type TYPE
+#define TTreeIterator_Field(NAME,TYPE) \
+  struct NAME : ::TTreeIterator::Field<TYPE> { static constexpr const char* name() { return #NAME; } }
+
+// A Typed tree has a fixed list of fields (branches), eg.
+//   TTreeIterator_Field(x,double);
+//   TTreeIterator_Field(n,int);
+//   TTreeIterator iter ("tree", &file);
+//   for (auto& entry : TTreeIterator::Typed<x,n>(iter)) {
+//     double vx = entry.get<x>();   // or entry.get<0>(), or (C++20) entry.Get<"x">()
+//     int    vn = entry.get<n>();
+//   }
+// Each value is kept in a std::tuple member and the branch addresses point straight at it,
+// so there is no any_cast, type check, or branch name lookup when accessing the values.
+// Each branch is read the first time it is accessed in an entry.
+template <typename... Fields>
+class TTreeIterator::Typed {
+  static_assert (sizeof...(Fields) > 0, "TTreeIterator::Typed requires at least one field");
+public:
+  using fields_type = std::tuple<Fields...>;
+  using tuple_type  = std::tuple<typename Fields::type...>;
+  template <std::size_t I> using field_type = typename std::tuple_element<I, fields_type>::type;
+  template <std::size_t I> using value_type = typename std::tuple_element<I, tuple_type >::type;
+
+  static constexpr std::size_t size() { return sizeof...(Fields); }
+  static const char* name (std::size_t i) {
+    static const char* const names[] = { Fields::name()... };
+    return names[i];
+  }
+
+  // Interface to std::iterator to allow range-based for loop.
+  // All copies refer to the same Typed object, so this is an input iterator.
+  class iterator
+    : public std::iterator< std::input_iterator_tag,   // iterator_category
+                            Typed,                     // value_type
+                            Long64_t,                  // difference_type
+                            const Typed*,              // pointer
+                            const Typed& >             // reference
+  {
+  public:
+    iterator (Typed& typed, Long64_t first, Long64_t last) : fIndex(first), fEnd(last), fTyped(typed) {}
+    iterator& operator++() { ++fIndex; return *this; }
+    iterator  operator++(int) { iterator it = *this; ++fIndex; return it; }
+    bool operator!= (const iterator& other) const { return fIndex != other.fIndex; }
+    bool operator== (const iterator& other) const { return fIndex == other.fIndex; }
+    const Typed& operator*() const { return fTyped.LoadTree (fIndex < fEnd ? fIndex : -1); }
+    Long64_t index() const { return fIndex; }
+  protected:
+    Long64_t fIndex;
+    Long64_t fEnd;
+    Typed&   fTyped;
+  };
+
+  Typed (TTreeIterator& treeI) : fTreeI(treeI), fValues(type_default<typename Fields::type>()...) {
+    for (std::size_t i = 0; i < size(); ++i) {
+      fBranches[i] = nullptr;
+      fObjs[i]     = nullptr;
+      fLastGet[i]  = -1;
+    }
+  }
+  ~Typed();
+
+  // branch addresses point into this object, so don't allow copies
+  Typed (const Typed&)            = delete;
+  Typed& operator= (const Typed&) = delete;
+
+  iterator begin();
+  iterator end();
+
+  // Access by field index or field type
+  template <std::size_t I>
+  const value_type<I>& get() const {
+    if (fLastGet[I] != fIndex) GetBranch (I);
+    return std::get<I>(fValues);
+  }
+  template <typename F>
+  const typename F::type& get() const { return get<index_of<F, Fields...>::value>(); }
+
+#if defined(__cpp_nontype_template_args) && (__cpp_nontype_template_args >= 201911L)
+  // Access by field name, eg. entry.Get<"x">()
+  template <std::size_t N>
+  struct FieldName {
+    constexpr FieldName (const char (&s)[N]) { for (std::size_t i = 0; i < N; ++i) str[i] = s[i]; }
+    char str[N];
+  };
+  template <FieldName S>
+  const auto& Get() const {
+    constexpr std::size_t i = find_field (S.str);
+    static_assert (i < size(), "TTreeIterator::Typed has no field with this name");
+    return get<i>();
+  }
+#endif
+
+  // common accessors
+  Long64_t          index()   const { return fIndex;           }
+  int               verbose() const { return fTreeI.verbose(); }
+  TTreeIterator&    tree()    const { return fTreeI;           }
+  TTree*            GetTree() const { return fTreeI.GetTree(); }
+
+protected:
+  template <typename F, typename... Fs> struct index_of;
+  template <typename F, typename... Fs> struct index_of<F, F, Fs...> : std::integral_constant<std::size_t, 0> {};
+  template <typename F, typename G, typename... Fs> struct index_of<F, G, Fs...> : std::integral_constant<std::size_t, 1+index_of<F, Fs...>::value> {};
+
+#if defined(__cpp_nontype_template_args) && (__cpp_nontype_template_args >= 201911L)
+  static constexpr std::size_t find_field (const char* name) {
+    const char* const names[] = { Fields::name()... };
+    for (std::size_t i = 0; i < size(); ++i) {
+      const char *a = names[i], *b = name;
+      while (*a && *a == *b) { ++a; ++b; }
+      if (*a == *b) return i;
+    }
+    return size();
+  }
+#endif
+
+  const Typed& LoadTree (Long64_t index) {
+    fIndex = index;
+    fLocalIndex = GetTree()->LoadTree (index);
+    if (GetTree()->GetTreeNumber() != fTreeNumber) ChangeTree();
+    return *this;
+  }
+  void ChangeTree();
+  void GetBranch (std::size_t i) const;
+
+  template <std::size_t I> bool SetBranchAddress();
+  template <std::size_t I> typename std::enable_if<(I <  sizeof...(Fields))>::type SetBranchAddressAll() { SetBranchAddress<I>(); SetBranchAddressAll<I+1>(); }
+  template <std::size_t I> typename std::enable_if<(I == sizeof...(Fields))>::type SetBranchAddressAll() {}
+
+  TTreeIterator&    fTreeI;
+  tuple_type        fValues;
+  void*             fObjs     [sizeof...(Fields)];  // object pointers, for branches that need a T** address
+  TBranch*          fBranches [sizeof...(Fields)];
+  mutable Long64_t  fLastGet  [sizeof...(Fields)];
+  Long64_t          fIndex      = -1;
+  Long64_t          fLocalIndex = -1;
+  Int_t             fTreeNumber = -1;
+  bool              fBound      = false;
+  mutable ULong64_t fTotRead    = 0;
+};
+
+
+template <typename... Fields>
+inline TTreeIterator::Typed<Fields...>::~Typed() {
+  if (verbose() >= 1 && fTotRead > 0)
+    tree().Info ("Typed", "read %lld bytes total", fTotRead);
+  if (!fBound || !GetTree()) return;
+  for (std::size_t i = 0; i < size(); ++i)
+    if (fBranches[i]) GetTree()->ResetBranchAddress (fBranches[i]);
+}
+
+
+template <typename... Fields>
+inline typename TTreeIterator::Typed<Fields...>::iterator TTreeIterator::Typed<Fields...>::begin() {
+  Long64_t last = GetTree() ? GetTree()->GetEntries() : 0;
+  if (last > 0) {
+    // Bind on every pass: an Entry loop since the last pass may have set its own addresses for our branches.
+    fTreeI.ResetBranchAddresses();   // drop the kept Entry's addresses, so it doesn't reset ours later
+    SetBranchAddressAll<0>();
+    fBound = true;
+    fTreeNumber = -1;
+    for (std::size_t i = 0; i < size(); ++i) fLastGet[i] = -1;
+  }
+  return iterator (*this, 0, last);
+}
+
+
+template <typename... Fields>
+inline typename TTreeIterator::Typed<Fields...>::iterator TTreeIterator::Typed<Fields...>::end() {
+  Long64_t last = GetTree() ? GetTree()->GetEntries() : 0;
+  return iterator (*this, last, last);
+}
+
+
+// Set the branch address to point to our value. This is done at the start of each pass: a TChain keeps the address for each new tree.
+template <typename... Fields>
+template <std::size_t I>
+inline bool TTreeIterator::Typed<Fields...>::SetBranchAddress() {
+  using V = value_type<I>;
+  const char* bname = name(I);
+  TBranch* branch = GetTree()->GetBranch (bname);
+  if (!branch) {
+    if (verbose() >= 0) tree().Error (tname<V>("Typed"), "branch '%s' not found", bname);
+    return false;
+  }
+  bool isobj = false;
+  if (TClass::GetClass<V>() && branch->GetMother() == branch) {
+    TClass* expectedClass = 0;
+    EDataType expectedType = kOther_t;
+    if (!branch->GetExpectedType (expectedClass, expectedType) && expectedClass) isobj = true;
+  }
+  V* pvalue = &std::get<I>(fValues);
+  Int_t stat;
+  if (isobj) {
+    fObjs[I] = pvalue;
+    stat = GetTree()->SetBranchAddress (bname, reinterpret_cast<V**>(&fObjs[I]));
+  } else {
+    stat = GetTree()->SetBranchAddress (bname, pvalue);
+  }
+  if (stat < 0) {
+    if (verbose() >= 0) tree().Error (tname<V>("Typed"), "failed to set branch '%s' %s address %p", bname, (isobj?"object":"variable"), (void*)pvalue);
+    return false;
+  }
+  if   (verbose() >= 1) tree().Info  (tname<V>("Typed"), "set branch '%s' %s address %p",           bname, (isobj?"object":"variable"), (void*)pvalue);
+  fBranches[I] = branch;
+  return true;
+}
+
+
+template <typename... Fields>
+inline void TTreeIterator::Typed<Fields...>::ChangeTree() {
+  fTreeNumber = GetTree()->GetTreeNumber();
+  for (std::size_t i = 0; i < size(); ++i) {
+    fLastGet[i] = -1;
+    if (fBranches[i]) fBranches[i] = GetTree()->GetBranch (name(i));
+  }
+}
+
+
+template <typename... Fields>
+inline void TTreeIterator::Typed<Fields...>::GetBranch (std::size_t i) const {
+  fLastGet[i] = fIndex;
+  TBranch* branch = fBranches[i];
+  if (!branch || fIndex < 0) return;
+  Int_t nread = branch->GetEntry (fLocalIndex, 1);
+  if (nread > 0) {
+    fTotRead += nread;
+    if (verbose() >= 2) tree().Info  ("Typed", "branch '%s' read %d bytes from entry %lld", name(i), nread, fIndex);
+  } else {
+    if (verbose() >= 0) tree().Error ("Typed", "branch '%s' read %d bytes from entry %lld", name(i), nread, fIndex);
+  }
+}
+
+#endif /* ROOT_TTreeIterator_typed */
@@ -0,0 +1,113 @@
+// Selection-first loops over a TTree, using TTreeIterator::Where().
+
+#ifndef ROOT_TTreeIterator_where
+#define ROOT_TTreeIterator_where
+
+#include <type_traits>
+
+// ===========================================================================
+// Loop over the entries that pass pred(entry), eg.
+//   auto pass = [](const TTreeIterator::Entry& e) { return e.Get<double>("pt") > 100.0 && std::abs(e.Get<double>("eta")) < 2.5; };
+//   for (auto& entry : iter.Where (pass, {"pt","eta"})) {
+//     auto& tracks = entry.Get<std::vector<Track>>("tracks");
+//     ...
+//   }
+// The predicate is called for all the entries in a TTree cluster first, then the loop body for those that passed.
+// Branches are only read when they are used, so a branch only used in the loop body only has its baskets read
+// and decompressed where they contain entries that passed.
+// If the predicate's branches are listed, only they are put in the TTreeCache, so the other branches' baskets
+// aren't even read from the file for clusters where no entries pass. At the end of the loop, the TTreeCache is
+// replaced by a new one, which learns the branches used by the next loop. If no branches are listed, the
+// TTreeCache is set up as for an ordinary loop (see SetLearnEntries), so includes the branches used in the loop body.
+template <typename F>
+class TTreeIterator::Where_iterator : public Entry_iterator {
+public:
+  Where_iterator (TTreeIterator& treeI, Long64_t first, Long64_t last, F pred)
+    : Entry_iterator(treeI,first,last), fState(std::make_shared<State>(std::move(pred))) {}
+  Where_iterator& operator++() {
+    if (++fPos < fState->fPass.size()) fIndex = fState->fPass[fPos];
+    else NextCluster (fState->fClusterEnd);
+    return *this;
+  }
+  Where_iterator  operator++(int) { Where_iterator it = *this; ++*this; return it; }
+
+  Where_iterator begin() { Where_iterator it = *this; it.NextCluster (fIndex); return it; }
+  Where_iterator end()   { Where_iterator it = *this; it.fIndex = fEnd;        return it; }
+
+protected:
+  // shared between copies of the iterator
+  struct State {
+    State (F&& pred) : fPred(std::move(pred)) {}
+    F                     fPred;
+    std::vector<Long64_t> fPass;           // entries in the current cluster that passed
+    Long64_t              fClusterEnd = 0;
+    Long64_t              fNtested    = 0;
+    Long64_t              fNpassed    = 0;
+  };
+
+  void NextCluster (Long64_t first);
+
+  std::shared_ptr<State> fState;
+  std::size_t fPos = 0;   // index of fIndex in fState->fPass
+};
+
+
+// ===========================================================================
+// TTreeIterator::Where_iterator ============================================
+// ===========================================================================
+
+template <typename F>
+inline TTreeIterator::Where_iterator<typename std::decay<F>::type>
+TTreeIterator::Where (F&& pred, const std::vector<std::string>& branches/*={}*/) {
+  Long64_t last = GetTree() ? GetTree()->GetEntries() : 0;
+  if (verbose() >= 1 && last>0 && GetTree()->GetDirectory())
+    Info ("TTreeIterator", "select from %lld entries of tree '%s' in file %s", last, GetTree()->GetName(), GetTree()->GetDirectory()->GetName());
+  Where_iterator<typename std::decay<F>::type> it (*this, 0, last, std::forward<F>(pred));
+  if (!branches.empty() && last > 0) {
+    it.fEntry->fLearn = -2;   // TTreeCache is frozen: don't let TrainCache() or GetBranch() add the loop body's branches
+    for (auto& name : branches) GetTree()->AddBranchToCache (name.c_str(), true);
+    GetTree()->StopCacheLearningPhase();
+    it.fEntry->fFrozenCache = GetTree()->GetCacheSize();   // replaced at the end of the loop
+  }
+  return it;
+}
+
+
+// Find the next cluster, starting at entry first, with any entries that pass the predicate, and move to the first of them.
+template <typename F>
+inline void TTreeIterator::Where_iterator<F>::NextCluster (Long64_t first) {
+  State& s = *fState;
+  s.fPass.clear();
+  fPos = 0;
+  for (; first < fEnd; first = s.fClusterEnd) {
+    s.fClusterEnd = tree().ClusterEnd (first);
+    if (s.fClusterEnd > fEnd) s.fClusterEnd = fEnd;
+    for (Long64_t i = first; i < s.fClusterEnd; ++i) {
+      const Entry& entry = fEntry->LoadTree (i);
+      if (s.fPred (entry)) s.fPass.push_back (i);
+    }
+    s.fNtested += s.fClusterEnd - first;
+    s.fNpassed += s.fPass.size();
+    if (verbose() >= 2) tree().Info ("Where", "%zu of entries %lld - %lld passed", s.fPass.size(), first, s.fClusterEnd-1);
+    if (!s.fPass.empty()) {
+      fIndex = s.fPass.front();
+      return;
+    }
+  }
+  fIndex = fEnd;
+  if (verbose() >= 1 && s.fNtested > 0)
+    tree().Info ("Where", "%lld of %lld entries passed", s.fNpassed, s.fNtested);
+}
+
+
+// First entry after the cluster containing entry (or entry+1 if that isn't known)
+inline Long64_t TTreeIterator::ClusterEnd (Long64_t entry) const {
+  Long64_t local = fTree ? fTree->LoadTree (entry) : -1;
+  TTree* t = fTree ? fTree->GetTree() : nullptr;   // current tree in a TChain
+  if (local < 0 || !t) return entry+1;
+  TTree::TClusterIterator clusters = t->GetClusterIterator (local);
+  clusters.Next();
+  return entry - local + clusters.GetNextEntry();
+}
+
+#endif /* ROOT_TTreeIterator_where */
@@ -0,0 +1,108 @@
+#ifndef HEADER_fundamental_any
+#define HEADER_fundamental_any
+
+#include <new>
+#include <utility>
+#include <type_traits>
+#include "RtypesCore.h"
+
+// Holds a value of any type, like Any (std::any or Cpp11::any), but with a fast path for the common
+// fundamental types. These are stored in a tagged union, so get<double>() is just a tag compare
+// and a load, with no manager function call. All other types (classes, STL containers, etc) are
+// held in the Any.
+
+namespace Cpp11 {
+
+  namespace fundamental_any_detail {
+    struct none;
+    template <typename T> void any_cast (none*);   // never called: lets any_cast<T>(p) parse as a template, so ADL finds the Any's any_cast
+  }
+
+  template <typename Any>
+  class fundamental_any {
+  public:
+    enum Kind : unsigned char { kAny, kDouble, kFloat, kLong64, kULong64, kLong, kULong, kInt, kUInt, kShort, kUShort, kChar, kUChar, kBool };
+
+    // tag for a type, or kAny if it isn't one of the fundamental types
+    template <typename T> static constexpr Kind kind() { return KindOf (static_cast<typename std::remove_cv<T>::type*>(nullptr)); }
+
+    template <typename T, typename V = typename std::decay<T>::type,
+              typename std::enable_if<!std::is_same<V, fundamental_any>::value, bool>::type = true>
+    fundamental_any (T&& value) : fKind(kind<V>()) {
+      Create<V> (std::forward<T>(value), std::integral_constant<bool, kind<V>() != kAny>());
+    }
+
+    fundamental_any (const fundamental_any& other) : fKind(other.fKind) {
+      if (fKind == kAny) ::new (&fStorage.fAny) Any (other.fStorage.fAny);
+      else               fStorage.fFund = other.fStorage.fFund;
+    }
+
+    fundamental_any (fundamental_any&& other) noexcept : fKind(other.fKind) {
+      if (fKind == kAny) ::new (&fStorage.fAny) Any (std::move(other.fStorage.fAny));
+      else               fStorage.fFund = other.fStorage.fFund;
+    }
+
+    fundamental_any& operator= (const fundamental_any& rhs) {
+      if (this != &rhs) {
+        this->~fundamental_any();
+        ::new (this) fundamental_any (rhs);
+      }
+      return *this;
+    }
+
+    fundamental_any& operator= (fundamental_any&& rhs) noexcept {
+      if (this != &rhs) {
+        this->~fundamental_any();
+        ::new (this) fundamental_any (std::move(rhs));
+      }
+      return *this;
+    }
+
+    ~fundamental_any() { if (fKind == kAny) fStorage.fAny.~Any(); }
+
+    Kind GetKind() const { return fKind; }
+
+    // Address of the contained value, or nullptr if it isn't a T
+    template <typename T> const T* get() const { return Get<T> (std::integral_constant<bool, kind<T>() != kAny>()); }
+    template <typename T>       T* get()       { return const_cast<T*> (static_cast<const fundamental_any*>(this)->get<T>()); }
+
+  protected:
+    template <typename T> static constexpr Kind KindOf (T*)        { return kAny;     }
+    static constexpr Kind KindOf (Double_t*)  { return kDouble;  }
+    static constexpr Kind KindOf (Float_t*)   { return kFloat;   }
+    static constexpr Kind KindOf (Long64_t*)  { return kLong64;  }
+    static constexpr Kind KindOf (ULong64_t*) { return kULong64; }
+    static constexpr Kind KindOf (Long_t*)    { return kLong;    }
+    static constexpr Kind KindOf (ULong_t*)   { return kULong;   }
+    static constexpr Kind KindOf (Int_t*)     { return kInt;     }
+    static constexpr Kind KindOf (UInt_t*)    { return kUInt;    }
+    static constexpr Kind KindOf (Short_t*)   { return kShort;   }
+    static constexpr Kind KindOf (UShort_t*)  { return kUShort;  }
+    static constexpr Kind KindOf (Char_t*)    { return kChar;    }
+    static constexpr Kind KindOf (UChar_t*)   { return kUChar;   }
+    static constexpr Kind KindOf (Bool_t*)    { return kBool;    }
+
+    template <typename V, typename T> void Create (T&& value, std::true_type)  { ::new (&fStorage.fFund) V (std::forward<T>(value)); }
+    template <typename V, typename T> void Create (T&& value, std::false_type) { ::new (&fStorage.fAny)  Any (std::forward<T>(value)); }
+
+    template <typename T> const T* Get (std::true_type) const {
+      return fKind == kind<T>() ? reinterpret_cast<const T*>(&fStorage.fFund) : nullptr;
+    }
+    template <typename T> const T* Get (std::false_type) const {
+      using V = typename std::remove_cv<T>::type;
+      using fundamental_any_detail::any_cast;
+      return fKind == kAny ? any_cast<V> (&fStorage.fAny) : nullptr;
+    }
+
+    union Storage {
+      Storage() {}
+      ~Storage() {}
+      typename std::aligned_storage<sizeof(Long64_t), alignof(Long64_t)>::type fFund;
+      Any fAny;
+    } fStorage;
+    Kind fKind;
+  };
+
+}
+
+#endif /* HEADER_fundamental_any */
@@ -49,6 +49,7 @@
 #endif
 
 #include "TTreeIterator/detail/TTreeIterator_helpers.h"  // Implementation of std::any, compatible with C++11.
+#include "TTreeIterator/detail/fundamental_any.h"        // tagged union for fundamental types, any for the rest
 
   namespace any_ns1 = ::std;
   using any_type1 = std::any;
@@ -59,6 +60,7 @@
   namespace any_ns2 = ::std;
   using any_type2 = std::any;
 #endif
+  using any_type3 = Cpp11::fundamental_any<any_type2>;
 
 #include <vector>
 #include <string>
@@ -115,6 +117,26 @@ static void BM_Cpp11_any(benchmark::State& state) {
 }
 BENCHMARK(BM_Cpp11_any);
 
+static void BM_fundamental_any(benchmark::State& state) {
+#ifdef TEST_SAME_TYPE
+  auto a = get_any<any_type3>(1);
+  const std::string s("abc");
+  for (auto _ : state) {
+    a = 3.1;
+    benchmark::DoNotOptimize(a);
+    a = s;
+    benchmark::DoNotOptimize(a);
+  }
+#else
+  const auto a = get_any<any_type3>();
+  for (auto _ : state) {
+    auto d = *a.get<double>();
+    benchmark::DoNotOptimize(d);
+  }
+#endif
+}
+BENCHMARK(BM_fundamental_any);
+
 BENCHMARK_MAIN();
 
 #else
@@ -123,8 +145,10 @@ BENCHMARK_MAIN();
 int main(int, char**) {
   auto a1 = get_any<any_type1>();
   auto a2 = get_any<any_type2>();
-  std::cout << type_name<decltype(a1)>() << ' ' << type_name<decltype(a2)>() << '\n';
+  auto a3 = get_any<any_type3>();
+  std::cout << type_name<decltype(a1)>() << ' ' << type_name<decltype(a2)>() << ' ' << type_name<decltype(a3)>() << '\n';
   return any_ns1::any_cast<double>(a1) +
-         any_ns2::any_cast<double>(a2);
+         any_ns2::any_cast<double>(a2) +
+         *a3.get<double>();
 }
 #endif
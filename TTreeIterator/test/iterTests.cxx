@@ -16,6 +16,7 @@
 #include "TH1.h"
 #include "TRandom3.h"
 #include "TTreeReader.h"
+#include "TTreeCache.h"
 
 #include "TTreeIterator/TTreeIterator.h"
 
@@ -199,6 +200,13 @@ TEST(iterTests1, AlgIter) {
   std::cout << "vx = ";
   for (auto& x : vx) { if (&x != &vx.front()) std::cout << ','; std::cout << x; }
   std::cout << '\n';
+
+  auto it = iter.begin();
+  auto it0 = it++;   // copies share the same Entry, so advancing one changes what the other refers to
+  EXPECT_EQ (it0.index()+1, it.index());
+  EXPECT_EQ (&*it0, &*it);
+  bool input = std::is_same<std::iterator_traits<TTreeIterator::Entry_iterator>::iterator_category, std::input_iterator_tag>::value;
+  EXPECT_TRUE (input);   // not a forward iterator, so not for multi-pass algorithms
 }
 
 // ==========================================================================================
@@ -462,6 +470,455 @@ TEST(iterTests4, GetIter) {
   c1.Print("xyz.pdf)");
 }
 
+namespace xyz {
+  TTreeIterator_Field(vx,double);
+  TTreeIterator_Field(vy,double);
+  TTreeIterator_Field(vz,double);
+}
+
+TEST(iterTests4, MultiPass) {
+  TFile file ("xyz.root");
+  if (file.IsZombie()) return;
+
+  TTreeIterator tree("xyz", &file);
+  const TTreeIterator::Entry* first = nullptr;
+  double sum0 = 0.0;
+  for (int pass = 0; pass < 3; pass++) {
+    double sum = 0.0;
+    for (auto& entry : tree) {
+      if (!first) first = &entry;
+      EXPECT_EQ (&entry, first);   // Entry, with its branch addresses, is kept for the next pass
+      sum += entry.Get<double>("vx");
+    }
+    if (pass == 0) sum0 = sum;
+    else           EXPECT_EQ (sum, sum0);
+  }
+}
+
+
+TEST(iterTests4, MultiPassUserAddress) {
+  TFile file ("xyz.root");
+  if (file.IsZombie()) return;
+
+  TTreeIterator tree("xyz", &file);
+  double sum1 = 0.0;
+  for (auto& entry : tree) sum1 += entry.Get<double>("vx");
+  double vx = 0.0;
+  tree->SetBranchAddress ("vx", &vx);   // between passes, so the kept Entry must read through our address
+  double sum2 = 0.0, sum3 = 0.0;
+  for (auto& entry : tree) {
+    sum2 += entry.Get<double>("vx");
+    sum3 += vx;
+  }
+  EXPECT_EQ (sum2, sum1);
+  EXPECT_EQ (sum3, sum1);
+}
+
+
+TEST(iterTests4, FileClosedFirst) {
+  std::unique_ptr<TFile> file (new TFile ("xyz.root"));
+  if (file->IsZombie()) return;
+
+  TTreeIterator tree("xyz", file.get());
+  double sum = 0.0;
+  for (auto& entry : tree) sum += entry.Get<double>("vx");
+  EXPECT_NE (sum, 0.0);
+  file.reset();   // deletes the tree and its branches, so the kept Entry must be dropped
+  EXPECT_EQ (tree.GetTree(), nullptr);
+}   // ~TTreeIterator doesn't touch the deleted branches
+
+
+TEST(iterTests4, GetCached) {
+  TFile file ("xyz.root");
+  if (file.IsZombie()) return;
+
+  TTreeIterator tree("xyz", &file);
+  Long64_t n = 0;
+  for (int pass = 0; pass < 2; pass++) {   // each pass reuses the kept Entry, so the call-site cache stays valid
+    for (auto& entry : tree) {
+      EXPECT_EQ (TTreeIterator_Get(entry, "vx", double), entry.Get<double>("vx"));
+      n++;
+    }
+  }
+  EXPECT_EQ (n, 2*tree.GetEntries());
+}
+
+
+TEST(iterTests4, GetTyped) {
+  TFile file ("xyz.root");
+  if (file.IsZombie()) return;
+
+  TH2D hxy ("vxy", "vxy", 48, -6, 6, 32, -4, 4);
+  TH1D hz  ("vz",  "vz",  100, -200, 200);
+
+  TTreeIterator tree("xyz", &file);
+  TTreeIterator::Typed<xyz::vx,xyz::vy,xyz::vz> typed (tree);
+  Long64_t n = 0;
+  for (auto& entry : typed) {
+    hxy.Fill (entry.get<xyz::vx>(), entry.get<1>());
+    hz .Fill (entry.get<xyz::vz>());
+    n++;
+  }
+  EXPECT_EQ (n, 10000);
+
+  TCanvas c1("c1");
+  hxy.Draw("colz");
+  c1.Print("xyzt.pdf(");
+  hz.Draw();
+  c1.Print("xyzt.pdf)");
+}
+
+TEST(iterTests4, TypedAfterEntry) {
+  TFile file ("xyz.root");
+  if (file.IsZombie()) return;
+
+  TTreeIterator tree("xyz", &file);
+  TTreeIterator::Typed<xyz::vx> typed (tree);
+  double sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+  for (auto& entry : typed) sum1 += entry.get<xyz::vx>();
+  for (auto& entry : tree)  sum2 += entry.Get<double>("vx");   // rebinds vx to the Entry
+  for (auto& entry : typed) sum3 += entry.get<xyz::vx>();
+  EXPECT_NEAR (sum2, sum1, 1e-9*std::abs(sum1));
+  EXPECT_NEAR (sum3, sum1, 1e-9*std::abs(sum1));
+}
+
+TEST(iterTests4, ParallelForEach) {
+  TFile file ("xyz.root");
+  if (file.IsZombie()) return;
+
+  TTreeIterator tree("xyz", &file);
+  double sum1 = 0.0;
+  for (auto& entry : tree) sum1 += entry.Get<double>("vx");
+
+  const unsigned int nthreads = 4;
+  std::vector<double>   sum (nthreads, 0.0);
+  std::vector<Long64_t> n   (nthreads, 0);
+  Long64_t nproc = tree.ParallelForEach (nthreads, [&](const TTreeIterator::Entry& entry, unsigned int slot) {
+    sum[slot] += entry.Get<double>("vx");
+    n[slot]++;
+  });
+  EXPECT_EQ (nproc, tree.GetEntries());
+  EXPECT_EQ (std::accumulate (n.begin(), n.end(), Long64_t(0)), tree.GetEntries());
+  EXPECT_NEAR (std::accumulate (sum.begin(), sum.end(), 0.0), sum1, 1e-9*std::abs(sum1));
+}
+
+TEST(iterTests4, ParallelChain) {
+  TTreeIterator tree("xyz");
+  if (tree.Add("xyz.root") <= 0) return;
+  tree.Add("xyz.root");
+  double sum1 = 0.0;
+  for (auto& entry : tree) sum1 += entry.Get<double>("vz");
+
+  const unsigned int nthreads = 8;
+  std::vector<double>   sum (nthreads, 0.0);
+  std::vector<Long64_t> n   (nthreads, 0);
+  Long64_t nproc = tree.ParallelForEach (nthreads, [&](const TTreeIterator::Entry& entry, unsigned int slot) {
+    sum[slot] += entry.Get<double>("vz");
+    n[slot]++;
+  });
+  EXPECT_EQ (nproc, tree.GetEntries());
+  EXPECT_EQ (std::accumulate (n.begin(), n.end(), Long64_t(0)), tree.GetEntries());
+  EXPECT_NEAR (std::accumulate (sum.begin(), sum.end(), 0.0), sum1, 1e-9*std::abs(sum1));
+}
+
+TEST(iterTests4, LazyChain) {
+  TTreeIterator tree("xyz");
+  if (tree.Add("xyz.root") <= 0) return;
+  tree.Add("xyz.root");
+  tree.SetLazyChain (true);
+  double sum1 = 0.0;
+  Long64_t n1 = 0;
+  for (auto& entry : tree) {   // doesn't need GetEntries()
+    sum1 += entry.Get<double>("vz");
+    n1++;
+  }
+
+  TTreeIterator tree2("xyz");
+  tree2.Add("xyz.root");
+  tree2.Add("xyz.root");
+  Long64_t nentries = tree2.PrescanChain (2);
+  EXPECT_EQ (nentries, tree2.GetEntries());
+  EXPECT_EQ (n1, nentries);
+  double sum2 = 0.0;
+  for (auto& entry : tree2) sum2 += entry.Get<double>("vz");
+  EXPECT_EQ (sum1, sum2);
+}
+
+TEST(iterTests4, PreOpen) {
+  TTreeIterator tree("xyz");
+  if (tree.Add("xyz.root") <= 0) return;
+  tree.Add("xyz.root");
+  tree.Add("xyz.root");
+  double sum1 = 0.0;
+  for (auto& entry : tree) sum1 += entry.Get<double>("vx");
+
+  tree.ResetBranchAddresses();   // so the next loop starts a new Entry
+  tree.SetPreOpen (0.5);
+  double sum2 = 0.0;
+  Long64_t n = 0;
+  for (auto& entry : tree) {
+    sum2 += entry.Get<double>("vx");
+    n++;
+  }
+  EXPECT_EQ (n, tree.GetEntries());
+  EXPECT_EQ (sum1, sum2);
+}
+
+TEST(iterTests4, Where) {
+  TFile file ("xyz.root");
+  if (file.IsZombie()) return;
+
+  TTreeIterator tree("xyz", &file);
+  double sum1 = 0.0;
+  Long64_t n1 = 0;
+  for (auto& entry : tree) {
+    if (!(entry.Get<double>("vx") > 8.0)) continue;
+    sum1 += entry.Get<double>("vy");
+    n1++;
+  }
+
+  double sum2 = 0.0;
+  Long64_t n2 = 0, last = -1;
+  for (auto& entry : tree.Where ([](const TTreeIterator::Entry& e) { return e.Get<double>("vx") > 8.0; }, {"vx"})) {
+    EXPECT_GT (entry.index(), last);
+    last = entry.index();
+    EXPECT_GT (entry.Get<double>("vx"), 8.0);
+    sum2 += entry.Get<double>("vy");
+    n2++;
+  }
+  EXPECT_GT (n1, 0);
+  EXPECT_EQ (n1, n2);
+  EXPECT_EQ (sum1, sum2);
+}
+
+TEST(iterTests4, WhereCache) {
+  TFile file ("xyz.root");
+  if (file.IsZombie()) return;
+
+  TTreeIterator tree("xyz", &file);
+  tree.SetLearnEntries (1);   // would add vy to the TTreeCache if Where didn't freeze it
+  Long64_t n = 0;
+  bool checked = false;
+  for (auto& entry : tree.Where ([](const TTreeIterator::Entry& e) { return e.Get<double>("vx") > 8.0; }, {"vx"})) {
+    if (entry.Get<double>("vy") != 0.0) n++;
+    if (checked) continue;
+    TTreeCache* cache = tree->GetReadCache (&file);
+    ASSERT_TRUE (cache);
+    EXPECT_TRUE  (cache->GetCachedBranches()->FindObject ("vx"));
+    EXPECT_FALSE (cache->GetCachedBranches()->FindObject ("vy"));   // only read for entries that passed
+    checked = true;
+  }
+  EXPECT_GT (n, 0);
+  EXPECT_TRUE (checked);
+
+  tree.SetLearnEntries (0);   // leave it to ROOT, which only learns vy if Where's frozen TTreeCache was replaced
+  double sum = 0.0;
+  for (auto& entry : tree) sum += entry.Get<double>("vy");
+  EXPECT_NE (sum, 0.0);
+  TTreeCache* cache = tree->GetReadCache (&file);
+  ASSERT_TRUE (cache);
+  EXPECT_TRUE (cache->GetCachedBranches()->FindObject ("vy"));
+}
+
+TEST(iterTests4, Select) {
+  TFile file ("xyz.root");
+  if (file.IsZombie()) return;
+
+  TTreeIterator tree("xyz", &file);
+  double sum1 = 0.0;
+  Long64_t n1 = 0, nx = 0;
+  for (auto& entry : tree) {
+    bool px = entry.Get<double>("vx") > 4.0, py = entry.Get<double>("vy") > 4.0;
+    if (px) nx++;
+    if (!(px && !py)) continue;
+    sum1 += entry.Get<double>("vz");
+    n1++;
+  }
+
+  auto sx = tree.Filter ([](const TTreeIterator::Entry& e) { return e.Get<double>("vx") > 4.0; });
+  auto sy = tree.Filter ([](const TTreeIterator::Entry& e) { return e.Get<double>("vy") > 4.0; });
+  EXPECT_EQ (sx.size(), nx);
+  auto sel = sx - sy;
+  EXPECT_EQ (sel.size(), n1);
+  EXPECT_EQ ((sx & sy).size() + sel.size(), sx.size());
+  EXPECT_EQ ((sx | sy).size(), sx.size() + sy.size() - (sx & sy).size());
+
+  double sum2 = 0.0;
+  Long64_t n2 = 0, last = -1;
+  for (auto& entry : tree.Select (sel)) {
+    EXPECT_GT (entry.index(), last);
+    last = entry.index();
+    EXPECT_TRUE (sel.Contains (entry.index()));
+    sum2 += entry.Get<double>("vz");
+    n2++;
+  }
+  EXPECT_EQ (n2, n1);
+  EXPECT_EQ (sum2, sum1);
+
+  double sum3 = 0.0;
+  Long64_t n3 = 0;
+  for (auto& entry : tree.Select (sx - sy)) {   // temporary Selection is kept by the iterator until the end of the loop
+    EXPECT_TRUE (sel.Contains (entry.index()));
+    sum3 += entry.Get<double>("vz");
+    n3++;
+  }
+  EXPECT_EQ (n3, n1);
+  EXPECT_EQ (sum3, sum1);
+
+  auto sel2 = tree.Filter (sx, [](const TTreeIterator::Entry& e) { return !(e.Get<double>("vy") > 4.0); });
+  EXPECT_EQ (sel2.size(), sel.size());
+  EXPECT_EQ ((sel2 - sel).size(), 0);
+}
+
+TEST(iterTests4, SelectionAlgebra) {
+  TTreeIterator::Selection even, third;   // dense enough to use bitmaps, with a sparse tail to use arrays
+  for (Long64_t i = 0; i < 300000; i += 2) even.Add(i);
+  for (Long64_t i = 0; i < 300000; i += 3) third.Add(i);
+  for (Long64_t i = 1000000; i < 2000000; i += 1000) { even.Add(i); third.Add(i+500); }
+  EXPECT_EQ (even.size(), 150000+1000);
+  EXPECT_EQ ((even & third).size(), 50000);
+  EXPECT_EQ ((even | third).size(), 150000+100000-50000+2000);
+  EXPECT_EQ ((even - third).size(), 100000+1000);
+  Long64_t n = 0, last = -1;
+  for (Long64_t i : even & third) {
+    EXPECT_EQ (i % 6, 0);
+    EXPECT_GT (i, last);
+    last = i;
+    n++;
+  }
+  EXPECT_EQ (n, 50000);
+  EXPECT_TRUE  (third.Contains (1000500));
+  EXPECT_FALSE (even.Contains  (1000500));
+}
+
+TEST(iterTests4, TouchedOnly) {
+  TFile file ("xyz.root");
+  if (file.IsZombie()) return;
+
+  TTreeIterator tree("xyz", &file);
+  tree.SetTouchedOnly (true);
+  for (auto& entry : tree) {
+    double vx = entry.Get<double>("vx");
+    if (entry.index() == 1) {
+      EXPECT_TRUE  (tree->GetBranchStatus("vx"));
+      EXPECT_FALSE (tree->GetBranchStatus("vy"));
+    } else if (entry.index() == 2) {
+      double vy = entry.Get<double>("vy");   // enabled again when needed
+      EXPECT_NE (vx, vy);
+    } else if (entry.index() == 3) {
+      EXPECT_TRUE  (tree->GetBranchStatus("vy"));
+      EXPECT_FALSE (tree->GetBranchStatus("vz"));
+    }
+  }
+  EXPECT_TRUE (tree->GetBranchStatus("vz"));
+}
+
+TEST(iterTests4, TouchedOnlyKeepsStatus) {
+  TFile file ("xyz.root");
+  if (file.IsZombie()) return;
+
+  TTreeIterator tree("xyz", &file);
+  tree->SetBranchStatus ("vz", 0);
+  tree.SetTouchedOnly (true);
+  double sum = 0.0;
+  for (auto& entry : tree) sum += entry.Get<double>("vx");
+  EXPECT_NE (sum, 0.0);
+  EXPECT_TRUE  (tree->GetBranchStatus("vx"));
+  EXPECT_TRUE  (tree->GetBranchStatus("vy"));
+  EXPECT_FALSE (tree->GetBranchStatus("vz"));   // disabled by the user, so still disabled after the loop
+}
+
+TEST(iterTests4, LearnEntries) {
+  TFile file ("xyz.root");
+  if (file.IsZombie()) return;
+
+  TTreeIterator tree("xyz", &file);
+  EXPECT_EQ (tree.GetLearnEntries(), 0);   // opt-in: by default the TTreeCache is left to ROOT
+  tree.SetLearnEntries (1);
+  double sum = 0.0;
+  for (auto& entry : tree) sum += entry.Get<double>("vx");
+  TTreeCache* cache = tree->GetReadCache (&file);
+  ASSERT_TRUE (cache);
+  EXPECT_TRUE  (cache->GetCachedBranches()->FindObject ("vx"));
+  EXPECT_FALSE (cache->GetCachedBranches()->FindObject ("vy"));
+}
+
+TEST(iterTests4, LateBranch) {
+  const Long64_t nfill = 20000, late = 15000;
+  {
+    TFile file ("xyzl.root", "recreate");
+    ASSERT_FALSE(file.IsZombie()) << "no file";
+    TTreeIterator iter ("xyz", &file, verbose);
+    for (auto& entry : iter.FillEntries(nfill)) {
+      entry["vx"] = double(entry.index());
+      if (entry.index() >= late) entry["vy"] = double(entry.index());   // back-filled with 0 for earlier entries
+      entry.Fill();
+    }
+  }
+
+  TFile file ("xyzl.root");
+  ASSERT_FALSE(file.IsZombie()) << "no file";
+  TTreeIterator tree ("xyz", &file);
+  Long64_t n = 0;
+  for (auto& entry : tree) {
+    EXPECT_EQ (entry.Get<double>("vy"), entry.index() >= late ? double(entry.index()) : 0.0);
+    n++;
+  }
+  EXPECT_EQ (n, nfill);
+  ASSERT_TRUE (tree->GetBranch("vx") && tree->GetBranch("vy"));
+  EXPECT_LE (tree->GetBranch("vy")->GetWriteBasket(), tree->GetBranch("vx")->GetWriteBasket());   // no extra small baskets
+}
+
+TEST(iterTests4, AutoTune) {
+  TFile file ("xyzt.root", "recreate");
+  ASSERT_FALSE(file.IsZombie()) << "no file";
+
+  const Long64_t nfill = 5000;
+  TTreeIterator iter ("xyz", &file, verbose);
+  iter.SetAutoTune (8000, 2, 1000);   // 8 kB clusters, but at least 2 of them
+  double v = vinit;
+  for (auto& entry : iter.FillEntries(nfill)) {
+    entry["vx"] = v++;
+    entry.Fill();
+  }
+  EXPECT_EQ   (iter->GetEntries(), nfill);
+  EXPECT_GT   (iter->GetAutoFlush(), 0);
+  EXPECT_LE   (iter->GetAutoFlush(), nfill/2);
+  ASSERT_TRUE (iter->GetBranch("vx"));
+  EXPECT_LT   (iter->GetBranch("vx")->GetBasketSize(), iter.GetBufsize());
+}
+
+
+TEST(iterTests4, ParallelFill) {
+  const unsigned int nthreads = 4;
+  const Long64_t nfill = 10000;
+  std::vector<Long64_t> n (nthreads, 0);
+  Long64_t nproc = TTreeIterator::ParallelFill ("xyzp.root", "xyz", nfill, nthreads, [&](TTreeIterator::Entry& entry, unsigned int slot) {
+    EXPECT_EQ (entry.index(), n[slot]);   // counts this thread's entries, even after its tree is sent to the merger
+    entry["slot"] = int(slot);
+    entry["n"]    = n[slot]++;
+    entry.Fill();
+  });
+  EXPECT_EQ (nproc, nfill);
+  EXPECT_EQ (std::accumulate (n.begin(), n.end(), Long64_t(0)), nfill);
+
+  TFile file ("xyzp.root");
+  if (file.IsZombie()) return;
+  TTreeIterator tree("xyz", &file);
+  EXPECT_EQ (tree.GetEntries(), nfill);
+  std::vector<Long64_t> nread (nthreads, 0), sum (nthreads, 0);
+  for (auto& entry : tree) {
+    int slot = entry["slot"];
+    ASSERT_TRUE (slot >= 0 && slot < int(nthreads));
+    nread[slot]++;
+    sum[slot] += entry.Get<Long64_t>("n");
+  }
+  for (unsigned int slot = 0; slot < nthreads; ++slot) {
+    EXPECT_EQ (nread[slot], n[slot]);
+    EXPECT_EQ (sum[slot], n[slot]*(n[slot]-1)/2);
+  }
+}
+
 TEST(iterTests4, GetAddr) {
   TFile file ("xyz.root");
   if (file.IsZombie()) return;
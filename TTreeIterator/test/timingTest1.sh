@@ -43,6 +43,9 @@ set +e
                                                  t 'SetBranchAddress' 'timingTests1.GetAddr'
                                                  t 'TTreeReaderValue' 'timingTests1.GetReader'
 c                                              ; t 'TTreeIterator'    'timingTests1.GetIter'
+                                                 t 'prefetch'         'timingTests1.GetPrefetch'
+                                                 t 'BranchColumn'     'timingTests1.GetColumn'
+                                                 t 'Batches'          'timingTests1.GetBatch'
 c -DFEWER_CHECKS=1 -DOVERRIDE_BRANCH_ADDRESS=1 ; t 'no checks'        'timingTests1.GetIter'
 
 run ./maketiming.sh
@@ -13,6 +13,7 @@
 #include "TFile.h"
 #include "TTree.h"
 #include "TTreeReader.h"
+#include "TTreeCacheUnzip.h"
 #include "TTreeReaderValue.h"
 #include "TTreeReaderArray.h"
 
@@ -275,6 +276,136 @@ TEST(timingTests1, GetIter3) {
 }
 
 
+TEST(timingTests1, GetPrefetch) {
+  TFile file ("test_timing1.root");
+  ASSERT_FALSE(file.IsZombie()) << "no file";
+
+  std::vector<std::string> bnames;
+  bnames.reserve(nx1);
+  for (size_t i=0; i<nx1; i++) bnames.emplace_back (Form("x%03zu",i));
+
+  TTreeIterator iter ("test", &file, verbose);
+  ASSERT_TRUE(iter.GetTree()) << "no tree";
+  EXPECT_EQ(iter.GetEntries(), nfill1);
+  Int_t nbranches = ShowBranches (file, iter.GetTree(), branch_type1);
+  EXPECT_EQ(nbranches, nx1);
+  iter.SetPrefetch (true);
+  bool parallelUnzip = TTreeCacheUnzip::IsParallelUnzip();
+
+  StartTimer timer (iter.GetTree());
+
+  double v = vinit, vsum=0.0;
+  for (auto& entry : iter) {
+    for (auto& b : bnames) {
+      double x = entry[b.c_str()];
+      vsum += x;
+#ifndef FAST_CHECKS
+      EXPECT_EQ (x, v++) << Form("entry %lld, branch %s",entry.index(),b.c_str());
+#endif
+    }
+  }
+  double vn = double(nbranches*nfill1);
+  EXPECT_FLOAT_EQ (0.5*vn*(vn+2*vinit-1), vsum);
+  EXPECT_EQ (TTreeCacheUnzip::IsParallelUnzip(), parallelUnzip);   // global setting restored at the end of the loop
+}
+
+
+TEST(timingTests1, GetColumn) {
+  TFile file ("test_timing1.root");
+  ASSERT_FALSE(file.IsZombie()) << "no file";
+
+  TTreeIterator iter ("test", &file, verbose);
+  ASSERT_TRUE(iter.GetTree()) << "no tree";
+  EXPECT_EQ(iter.GetEntries(), nfill1);
+  Int_t nbranches = ShowBranches (file, iter.GetTree(), branch_type1);
+  EXPECT_EQ(nbranches, nx1);
+
+  StartTimer timer (iter.GetTree());
+  std::vector<TTreeIterator::BranchColumn<double>> cols;
+  cols.reserve(nx1);
+  for (size_t i=0; i<nx1; i++) cols.emplace_back (iter.Column<double>(Form("x%03zu",i)));
+
+  double v = vinit, vsum=0.0;
+  for (auto& entry : iter) {
+    for (auto& col : cols) {
+      double x = col(entry);
+      vsum += x;
+#ifndef FAST_CHECKS
+      EXPECT_EQ (x, v++) << Form("entry %lld, branch %s",entry.index(),col.GetName().c_str());
+#endif
+    }
+  }
+  double vn = double(nbranches*nfill1);
+  EXPECT_FLOAT_EQ (0.5*vn*(vn+2*vinit-1), vsum);
+}
+
+
+TEST(timingTests1, GetBatch) {
+  TFile file ("test_timing1.root");
+  ASSERT_FALSE(file.IsZombie()) << "no file";
+
+  std::vector<std::string> bnames;
+  bnames.reserve(nx1);
+  for (size_t i=0; i<nx1; i++) bnames.emplace_back (Form("x%03zu",i));
+
+  TTreeIterator iter ("test", &file, verbose);
+  ASSERT_TRUE(iter.GetTree()) << "no tree";
+  EXPECT_EQ(iter.GetEntries(), nfill1);
+  Int_t nbranches = ShowBranches (file, iter.GetTree(), branch_type1);
+  EXPECT_EQ(nbranches, nx1);
+
+  StartTimer timer (iter.GetTree());
+
+  double vsum=0.0;
+  Long64_t n=0;
+  for (auto& batch : iter.Batches(1000)) {
+    for (size_t ib=0; ib<nx1; ib++) {
+      auto xs = batch.Get<double>(bnames[ib].c_str());
+      EXPECT_EQ (Long64_t(xs.size()), batch.size());
+      for (double x : xs) vsum += x;
+#ifndef FAST_CHECKS
+      for (size_t i=0; i<xs.size(); i++)
+        EXPECT_EQ (xs[i], vinit+double((batch.index()+i)*nx1+ib)) << Form("entry %lld, branch %s",batch.index()+i,bnames[ib].c_str());
+#endif
+    }
+    n += batch.size();
+  }
+  EXPECT_EQ (n, nfill1);
+  double vn = double(nbranches*nfill1);
+  EXPECT_FLOAT_EQ (0.5*vn*(vn+2*vinit-1), vsum);
+}
+
+
+TEST(timingTests1, FillColumns) {
+  TFile file ("test_timing1.root", "recreate");
+  ASSERT_FALSE(file.IsZombie()) << "no file";
+
+  std::vector<std::string> bnames;
+  bnames.reserve(nx1);
+  for (size_t i=0; i<nx1; i++) bnames.emplace_back (Form("x%03zu",i));
+
+  const Long64_t nchunk = 1000;
+  std::vector<std::vector<double>> xs (nx1, std::vector<double>(nchunk));
+
+  TTreeIterator iter ("test", verbose);
+  StartTimer timer (iter.GetTree(), true);
+  double v = vinit;
+  auto fill = iter.FillEntries(nfill1);
+  for (Long64_t i = 0; i < nfill1; i += nchunk) {
+    Long64_t n = (nfill1-i < nchunk) ? nfill1-i : nchunk;
+    for (Long64_t j = 0; j < n; j++)
+      for (auto& x : xs) x[j] = v++;
+    std::vector<TTreeIterator::FillColumn> columns;
+    columns.reserve(nx1);
+    for (size_t ib=0; ib<nx1; ib++) columns.emplace_back (bnames[ib].c_str(), xs[ib].data(), size_t(n));
+    EXPECT_EQ (fill.FillColumns (columns), n);
+  }
+  fill.Write();
+  Int_t nbranches = ShowBranches (file, iter.GetTree(), branch_type1, "filled");
+  EXPECT_FLOAT_EQ (vinit+double(nbranches*nfill1), v);
+}
+
+
 TEST(timingTests1, FillAddr) {
   TFile file ("test_timing1.root", "recreate");
   ASSERT_FALSE(file.IsZombie()) << "no file";
@@ -517,6 +648,23 @@ TEST(timingTests3, FillIter) {
   EXPECT_FLOAT_EQ (vinit+double(nbranches*nfill3*nx3), v);
 }
 
+TEST(timingTests3, FillRef) {
+  TFile file ("test_timing3.root", "recreate");
+  ASSERT_FALSE(file.IsZombie()) << "no file";
+
+  TTreeIterator iter ("test", verbose);
+  StartTimer timer (iter.GetTree(), true, nx3);
+  double v = vinit;
+  for (auto& entry : iter.FillEntries(nfill3)) {
+    auto& vx = entry.Ref<std::vector<double>>("vx");   // filled in place, reusing the vector's buffer
+    vx.resize(nx3);
+    for (size_t i=0; i<nx3; i++) vx[i] = v++;
+    entry.Fill();
+  }
+  Int_t nbranches = ShowBranches (file, iter.GetTree(), branch_type3, "filled");
+  EXPECT_FLOAT_EQ (vinit+double(nbranches*nfill3*nx3), v);
+}
+
 TEST(timingTests3, GetIter) {
   TFile file ("test_timing3.root");
   ASSERT_FALSE(file.IsZombie()) << "no file";